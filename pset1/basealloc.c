@@ -1,23 +1,63 @@
 #define M61_DISABLE 1
 #include "m61.h"
+#include <pthread.h>
+#include <string.h>
+
+#if M61_PRELOAD
+// libm61.so defines malloc and friends itself, so the base allocator
+// takes its memory from the C library's allocator underneath (glibc).
+void* __libc_malloc(size_t sz);
+void* __libc_calloc(size_t nmemb, size_t sz);
+void* __libc_realloc(void* ptr, size_t sz);
+void __libc_free(void* ptr);
+#define malloc __libc_malloc
+#define calloc __libc_calloc
+#define realloc __libc_realloc
+#define free __libc_free
+#endif
+#ifndef M61_PRELOAD
+#define M61_PRELOAD 0
+#endif
 
 
 // This file contains a base memory allocator guaranteed not to
 // overwrite freed allocations. No need to understand it.
+//
+// Every block ever allocated stays in `allocs`; a hash table maps each
+// block's address to its index, so base_free takes constant time. Freed
+// blocks wait in free lists bucketed by log2 of their size, and
+// base_malloc reuses one picked at random from the buckets that might fit,
+// so a block freed just now is rarely the one handed out next.
 
 
 typedef struct base_allocation {
     void* ptr;
     size_t sz;
+    int freed;
 } base_allocation;
 
+#define NBUCKETS 64                     // bucket b holds sizes [2^b, 2^(b+1))
+
+typedef struct base_bucket {
+    size_t* frees;                      // indexes into `allocs`
+    size_t n;
+    size_t capacity;
+} base_bucket;
+
 static base_allocation* allocs;
 static size_t nallocs;
 static size_t alloc_capacity;
-static size_t* frees;
-static size_t nfrees;
-static size_t free_capacity;
-static int disabled;
+static size_t* index_table;             // allocs index + 1 by address; 0 is empty
+static size_t index_capacity;
+static base_bucket buckets[NBUCKETS];
+// In libm61.so, m61's quarantine already delays reuse, and a program that
+// runs for hours cannot afford blocks that are never given back, so the
+// base allocator starts disabled there and passes straight through.
+static int disabled = M61_PRELOAD;
+// One global lock guards all of the above. Every base_malloc and base_free
+// takes it; m61 keeps it off its fast path with per-thread caches of freed
+// blocks, so only cache misses meet here.
+static pthread_mutex_t base_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static unsigned alloc_random(void) {
     static uint64_t x = 8973443640547502487ULL;
@@ -25,13 +65,64 @@ static unsigned alloc_random(void) {
     return x >> 32;
 }
 
+static int size_bucket(size_t sz) {
+    return sz ? 63 - __builtin_clzll(sz) : 0;
+}
+
+static size_t index_slot(void* ptr) {
+    uint64_t h = ((uintptr_t) ptr >> 4) * 0x9E3779B97F4A7C15ULL;
+    return (h ^ (h >> 32)) & (index_capacity - 1);
+}
+
+// return the index of `ptr` in `allocs`, or `nallocs` if there is none
+static size_t index_find(void* ptr) {
+    if (!index_capacity) {
+        return nallocs;
+    }
+    for (size_t s = index_slot(ptr); index_table[s]; s = (s + 1) & (index_capacity - 1)) {
+        if (allocs[index_table[s] - 1].ptr == ptr) {
+            return index_table[s] - 1;
+        }
+    }
+    return nallocs;
+}
+
+static void index_insert(size_t i) {
+    size_t s = index_slot(allocs[i].ptr);
+    while (index_table[s]) {
+        s = (s + 1) & (index_capacity - 1);
+    }
+    index_table[s] = i + 1;
+}
+
+// make room for one more entry, keeping the table at most half full
+static void index_reserve(void) {
+    if (2 * (nallocs + 1) <= index_capacity) {
+        return;
+    }
+    free(index_table);
+    index_capacity = index_capacity ? index_capacity * 2 : 128;
+    index_table = calloc(index_capacity, sizeof(size_t));
+    if (!index_table) {
+        abort();
+    }
+    for (size_t i = 0; i < nallocs; ++i) {
+        index_insert(i);
+    }
+}
+
 static void base_alloc_atexit(void);
 
 void* base_malloc(size_t sz) {
+    // once disabled, stay off the lock
+    if (__atomic_load_n(&disabled, __ATOMIC_RELAXED)) {
+        return malloc(sz);
+    }
+    pthread_mutex_lock(&base_lock);
     if (disabled) {
+        pthread_mutex_unlock(&base_lock);
         return malloc(sz);
     }
-
     static int base_alloc_atexit_installed = 0;
     if (!base_alloc_atexit_installed) {
         atexit(base_alloc_atexit);
@@ -41,13 +132,28 @@ void* base_malloc(size_t sz) {
     unsigned r = alloc_random();
     // try to use a previously-freed block 75% of the time
     if (r % 4 != 0) {
-        for (unsigned try = 0; try < 10 && try < nfrees; ++try) {
-            size_t freenum = alloc_random() % nfrees;
-            size_t i = frees[freenum];
+        // blocks in lower buckets are all too small
+        int first = size_bucket(sz);
+        size_t ncandidates = 0;
+        for (int b = first; b < NBUCKETS; ++b) {
+            ncandidates += buckets[b].n;
+        }
+        for (unsigned try = 0; try < 10 && try < ncandidates; ++try) {
+            size_t pick = alloc_random() % ncandidates;
+            int b = first;
+            while (pick >= buckets[b].n) {
+                pick -= buckets[b].n;
+                ++b;
+            }
+            size_t i = buckets[b].frees[pick];
             if (allocs[i].sz >= sz) {
-                frees[freenum] = frees[nfrees - 1];
-                --nfrees;
-                return allocs[i].ptr;
+                buckets[b].frees[pick] = buckets[b].frees[buckets[b].n - 1];
+                --buckets[b].n;
+                allocs[i].freed = 0;
+                // read it before another thread can grow or free `allocs`
+                void* ptr = allocs[i].ptr;
+                pthread_mutex_unlock(&base_lock);
+                return ptr;
             }
         }
     }
@@ -61,43 +167,98 @@ void* base_malloc(size_t sz) {
     }
     void* ptr = malloc(sz);
     if (ptr) {
+        index_reserve();
         allocs[nallocs].ptr = ptr;
         allocs[nallocs].sz = sz;
+        allocs[nallocs].freed = 0;
+        index_insert(nallocs);
         ++nallocs;
     }
+    pthread_mutex_unlock(&base_lock);
     return ptr;
 }
 
 void base_free(void* ptr) {
-    if (disabled || !ptr) {
+    if (!ptr) {
+        return;
+    }
+    if (__atomic_load_n(&disabled, __ATOMIC_RELAXED)) {
         free(ptr);
         return;
     }
-    if (nfrees == free_capacity) {
-        free_capacity = free_capacity ? free_capacity * 2 : 64;
-        frees = realloc(frees, free_capacity * sizeof(size_t));
-        if (!frees) {
+    pthread_mutex_lock(&base_lock);
+    if (disabled) {
+        pthread_mutex_unlock(&base_lock);
+        free(ptr);
+        return;
+    }
+    size_t i = index_find(ptr);
+    // if not found or already free, invalid free; silently ignore it
+    if (i == nallocs || allocs[i].freed) {
+        pthread_mutex_unlock(&base_lock);
+        return;
+    }
+    base_bucket* bucket = &buckets[size_bucket(allocs[i].sz)];
+    if (bucket->n == bucket->capacity) {
+        bucket->capacity = bucket->capacity ? bucket->capacity * 2 : 64;
+        bucket->frees = realloc(bucket->frees, bucket->capacity * sizeof(size_t));
+        if (!bucket->frees) {
             abort();
         }
     }
-    for (size_t i = 0; i < nallocs; ++i) {
-        if (allocs[i].ptr == ptr) {
-            frees[nfrees] = i;
-            ++nfrees;
-            return;
+    bucket->frees[bucket->n] = i;
+    ++bucket->n;
+    allocs[i].freed = 1;
+    pthread_mutex_unlock(&base_lock);
+}
+
+void base_malloc_disable(int d) {
+    pthread_mutex_lock(&base_lock);
+    __atomic_store_n(&disabled, d, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&base_lock);
+}
+
+// Call `visit` on every freed block waiting for reuse, under the lock;
+// `visit` must not call base_malloc or base_free.
+void base_malloc_foreach_free(void (*visit)(void* ptr, size_t sz, void* arg), void* arg) {
+    pthread_mutex_lock(&base_lock);
+    for (int b = 0; b < NBUCKETS; ++b) {
+        for (size_t i = 0; i < buckets[b].n; ++i) {
+            base_allocation* a = &allocs[buckets[b].frees[i]];
+            visit(a->ptr, a->sz, arg);
         }
     }
-    // if we get here, invalid free; silently ignore it
+    pthread_mutex_unlock(&base_lock);
 }
 
-void base_malloc_disable(int d) {
-    disabled = d;
+// Hold base_lock across fork, so the child does not inherit it held by a
+// thread that no longer exists.
+void base_malloc_prefork(void) {
+    pthread_mutex_lock(&base_lock);
 }
 
+void base_malloc_postfork(void) {
+    pthread_mutex_unlock(&base_lock);
+}
+
+// Other threads may still be allocating while the program exits, so
+// release everything under the lock and leave the base allocator
+// disabled: later calls go straight to malloc and free. Blocks still in
+// use came from malloc, so freeing them later with free is fine.
 static void base_alloc_atexit(void) {
-    for (size_t i = 0; i < nfrees; ++i) {
-        free(allocs[frees[i]].ptr);
+    pthread_mutex_lock(&base_lock);
+    for (int b = 0; b < NBUCKETS; ++b) {
+        for (size_t i = 0; i < buckets[b].n; ++i) {
+            free(allocs[buckets[b].frees[i]].ptr);
+        }
+        free(buckets[b].frees);
     }
-    free(frees);
+    free(index_table);
     free(allocs);
+    allocs = NULL;
+    index_table = NULL;
+    nallocs = alloc_capacity = index_capacity = 0;
+    memset(buckets, 0, sizeof(buckets));
+    __atomic_store_n(&disabled, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&base_lock);
 }
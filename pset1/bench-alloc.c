@@ -0,0 +1,65 @@
+#include "m61.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+// bench-alloc: Measure m61 allocations per second for small objects.
+//
+// Keeps LIVE objects of random sizes in [1, MAXSIZE] alive and repeatedly
+// frees a random one and allocates a replacement. Link against m61.o
+// (bench-alloc) or m61-slab.o (bench-alloc-slab) to compare backends.
+
+static unsigned long long bench_random(void) {
+    static unsigned long long x = 88172645463325252ULL;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+}
+
+int main(int argc, char** argv) {
+    const char* name = argv[0];
+    if (argc > 1 && (strcmp(argv[1], "-h") == 0
+                     || strcmp(argv[1], "--help") == 0)) {
+        printf("Usage: %s [-b] [COUNT [MAXSIZE [LIVE]]]\n\
+\n\
+  Make COUNT allocations (default 10000000) of 1 to MAXSIZE bytes\n\
+  (default 256), keeping LIVE objects (default 10000) alive.\n\
+\n\
+  By default the base allocator passes through to the system allocator.\n\
+  -b keeps the real base allocator, whose free is slow.\n", argv[0]);
+        exit(0);
+    }
+    // use the system allocator, not the base allocator
+    // (the base allocator can be slow) unless asked
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        --argc, ++argv;
+    } else {
+        base_malloc_disable(1);
+    }
+    unsigned long long count = argc > 1 ? strtoull(argv[1], 0, 0) : 10000000;
+    size_t maxsize = argc > 2 ? strtoul(argv[2], 0, 0) : 256;
+    size_t live = argc > 3 ? strtoul(argv[3], 0, 0) : 10000;
+    if (count == 0 || maxsize == 0 || live == 0) {
+        fprintf(stderr, "%s: arguments must be positive\n", name);
+        exit(1);
+    }
+
+    void** ptrs = (void**) calloc(live, sizeof(void*));
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (unsigned long long i = 0; i < count; ++i) {
+        size_t slot = bench_random() % live;
+        free(ptrs[slot]);
+        ptrs[slot] = malloc(1 + bench_random() % maxsize);
+    }
+    for (size_t slot = 0; slot < live; ++slot) {
+        free(ptrs[slot]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(ptrs);
+
+    double elapsed = (end.tv_sec - begin.tv_sec)
+        + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    printf("%s: %llu allocations of 1-%zu bytes, %zu live, %.3f sec, %.0f allocations/sec\n",
+           name, count, maxsize, live, elapsed, count / elapsed);
+}
@@ -0,0 +1,74 @@
+#include "m61.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+// bench-batch: Compare m61_malloc_batch/m61_free_batch with single calls.
+//
+// Each round allocates N objects of SIZE bytes, then frees them all, first
+// with one malloc and free per object and then with one batch call each.
+// Link against m61.o (bench-batch) or m61-slab.o (bench-batch-slab) to
+// compare backends.
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+    const char* name = argv[0];
+    if (argc > 1 && (strcmp(argv[1], "-h") == 0
+                     || strcmp(argv[1], "--help") == 0)) {
+        printf("Usage: %s [-b] [ROUNDS [N [SIZE]]]\n\
+\n\
+  Allocate and free N objects (default 1000) of SIZE bytes (default 32)\n\
+  ROUNDS times (default 10000), with single calls and with batch calls.\n\
+\n\
+  By default the base allocator passes through to the system allocator.\n\
+  -b keeps the real base allocator, whose free is slow.\n", argv[0]);
+        exit(0);
+    }
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        --argc, ++argv;
+    } else {
+        base_malloc_disable(1);
+    }
+    unsigned long rounds = argc > 1 ? strtoul(argv[1], 0, 0) : 10000;
+    size_t n = argc > 2 ? strtoul(argv[2], 0, 0) : 1000;
+    size_t size = argc > 3 ? strtoul(argv[3], 0, 0) : 32;
+    if (rounds == 0 || n == 0) {
+        fprintf(stderr, "%s: arguments must be positive\n", name);
+        exit(1);
+    }
+    // no quarantine, so both loops reuse memory the same way
+    m61_set_quarantine(0, 0);
+
+    void** ptrs = (void**) calloc(n, sizeof(void*));
+    double begin = now();
+    for (unsigned long r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < n; ++i) {
+            ptrs[i] = malloc(size);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            free(ptrs[i]);
+        }
+    }
+    double single = now() - begin;
+
+    begin = now();
+    for (unsigned long r = 0; r < rounds; ++r) {
+        if (malloc_batch(ptrs, n, size) != n) {
+            fprintf(stderr, "%s: batch allocation failed\n", name);
+            exit(1);
+        }
+        free_batch(ptrs, n);
+    }
+    double batch = now() - begin;
+    free(ptrs);
+
+    double count = (double) rounds * n;
+    printf("%s: %lu rounds of %zu x %zu bytes\n", name, rounds, n, size);
+    printf("  single: %.3f sec, %.0f objects/sec\n", single, count / single);
+    printf("  batch:  %.3f sec, %.0f objects/sec (%.2fx)\n",
+           batch, count / batch, single / batch);
+}
@@ -0,0 +1,68 @@
+#include "m61.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+// bench-free: Measure m61_free with many live objects.
+//
+// Allocates LIVE objects, then frees them all in random order and times
+// the frees alone. Repeats ROUNDS times.
+
+static unsigned long long bench_random(void) {
+    static unsigned long long x = 88172645463325252ULL;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+}
+
+static double elapsed_since(struct timespec* begin) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - begin->tv_sec) + (end.tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && (strcmp(argv[1], "-h") == 0
+                     || strcmp(argv[1], "--help") == 0)) {
+        printf("Usage: %s [LIVE [ROUNDS]]\n\
+\n\
+  Free LIVE objects (default 1000000) in random order, ROUNDS times\n\
+  (default 5), and report the time per free.\n", argv[0]);
+        exit(0);
+    }
+    // use the system allocator, not the base allocator
+    // (the base allocator can be slow)
+    base_malloc_disable(1);
+
+    size_t live = argc > 1 ? strtoul(argv[1], 0, 0) : 1000000;
+    int rounds = argc > 2 ? strtol(argv[2], 0, 0) : 5;
+    if (live == 0 || rounds <= 0) {
+        fprintf(stderr, "%s: arguments must be positive\n", argv[0]);
+        exit(1);
+    }
+
+    void** ptrs = (void**) calloc(live, sizeof(void*));
+    double free_time = 0;
+    for (int r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < live; ++i) {
+            ptrs[i] = malloc(1 + bench_random() % 128);
+        }
+        // shuffle so frees hit memory in random order
+        for (size_t i = live - 1; i > 0; --i) {
+            size_t j = bench_random() % (i + 1);
+            void* tmp = ptrs[i];
+            ptrs[i] = ptrs[j];
+            ptrs[j] = tmp;
+        }
+        struct timespec begin;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        for (size_t i = 0; i < live; ++i) {
+            free(ptrs[i]);
+        }
+        free_time += elapsed_since(&begin);
+    }
+    free(ptrs);
+
+    printf("%s: %d rounds of %zu frees, %.3f sec freeing, %.1f ns/free\n",
+           argv[0], rounds, live, free_time, free_time * 1e9 / (rounds * live));
+}
@@ -0,0 +1,82 @@
+#include "m61.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+// bench-guard: Compare guard page mode with the default canary mode.
+//
+// Keeps LIVE objects of random sizes in [MINSIZE, MAXSIZE] alive and
+// repeatedly frees a random one and allocates a replacement, writing its
+// first and last byte, first with guard pages off and then with
+// m61_set_guard(MINSIZE). Link against m61.o (bench-guard) or m61-slab.o
+// (bench-guard-slab) to compare backends.
+
+static unsigned long long bench_random(void) {
+    static unsigned long long x = 88172645463325252ULL;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+}
+
+static double run(void** ptrs, unsigned long long count,
+                  size_t minsize, size_t maxsize, size_t live) {
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (unsigned long long i = 0; i < count; ++i) {
+        size_t slot = bench_random() % live;
+        free(ptrs[slot]);
+        size_t sz = minsize + bench_random() % (maxsize - minsize + 1);
+        char* p = (char*) malloc(sz);
+        p[0] = p[sz - 1] = 1;
+        ptrs[slot] = p;
+    }
+    for (size_t slot = 0; slot < live; ++slot) {
+        free(ptrs[slot]);
+        ptrs[slot] = NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+}
+
+int main(int argc, char** argv) {
+    const char* name = argv[0];
+    if (argc > 1 && (strcmp(argv[1], "-h") == 0
+                     || strcmp(argv[1], "--help") == 0)) {
+        printf("Usage: %s [-b] [COUNT [MINSIZE [MAXSIZE [LIVE]]]]\n\
+\n\
+  Make COUNT allocations (default 200000) of MINSIZE to MAXSIZE bytes\n\
+  (default 4096 to 65536), keeping LIVE objects (default 100) alive, with\n\
+  canaries and then with guard pages.\n\
+\n\
+  By default the base allocator passes through to the system allocator.\n\
+  -b keeps the real base allocator, whose free is slow.\n", argv[0]);
+        exit(0);
+    }
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        --argc, ++argv;
+    } else {
+        base_malloc_disable(1);
+    }
+    unsigned long long count = argc > 1 ? strtoull(argv[1], 0, 0) : 200000;
+    size_t minsize = argc > 2 ? strtoul(argv[2], 0, 0) : 4096;
+    size_t maxsize = argc > 3 ? strtoul(argv[3], 0, 0) : 65536;
+    size_t live = argc > 4 ? strtoul(argv[4], 0, 0) : 100;
+    if (count == 0 || minsize == 0 || live == 0 || maxsize < minsize) {
+        fprintf(stderr, "%s: arguments must be positive, MINSIZE <= MAXSIZE\n", name);
+        exit(1);
+    }
+
+    void** ptrs = (void**) calloc(live, sizeof(void*));
+    m61_set_guard(0);
+    double canary = run(ptrs, count, minsize, maxsize, live);
+    m61_set_guard(minsize);
+    double guard = run(ptrs, count, minsize, maxsize, live);
+    m61_set_guard(0);
+    free(ptrs);
+
+    printf("%s: %llu allocations of %zu-%zu bytes, %zu live\n",
+           name, count, minsize, maxsize, live);
+    printf("  canary: %.3f sec, %.0f allocations/sec\n", canary, count / canary);
+    printf("  guard:  %.3f sec, %.0f allocations/sec (%.2fx slower)\n",
+           guard, count / guard, guard / canary);
+}
@@ -0,0 +1,61 @@
+#include "m61.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+// bench-realloc: Measure realloc growing many buffers a byte at a time.
+//
+// Grows BUFFERS buffers from 1 to LENGTH bytes, one byte per realloc,
+// taking turns between buffers (so no buffer stays at the top of the
+// heap), and reports reallocs per second and how many moved the block.
+
+int main(int argc, char** argv) {
+    const char* name = argv[0];
+    if (argc > 1 && (strcmp(argv[1], "-h") == 0
+                     || strcmp(argv[1], "--help") == 0)) {
+        printf("Usage: %s [-b] [BUFFERS [LENGTH]]\n\
+\n\
+  Grow BUFFERS buffers (default 10000) to LENGTH bytes (default 1000)\n\
+  one byte at a time.\n\
+\n\
+  By default the base allocator passes through to the system allocator.\n\
+  -b keeps the real base allocator, whose free is slow.\n", argv[0]);
+        exit(0);
+    }
+    // use the system allocator, not the base allocator
+    // (the base allocator can be slow) unless asked
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        --argc, ++argv;
+    } else {
+        base_malloc_disable(1);
+    }
+    size_t nbuffers = argc > 1 ? strtoul(argv[1], 0, 0) : 10000;
+    size_t length = argc > 2 ? strtoul(argv[2], 0, 0) : 1000;
+    if (nbuffers == 0 || length == 0) {
+        fprintf(stderr, "%s: arguments must be positive\n", name);
+        exit(1);
+    }
+
+    char** bufs = (char**) calloc(nbuffers, sizeof(char*));
+    unsigned long long moves = 0;
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (size_t len = 1; len <= length; ++len) {
+        for (size_t i = 0; i < nbuffers; ++i) {
+            char* p = (char*) realloc(bufs[i], len);
+            moves += p != bufs[i];
+            p[len - 1] = (char) len;
+            bufs[i] = p;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    for (size_t i = 0; i < nbuffers; ++i) {
+        free(bufs[i]);
+    }
+    free(bufs);
+
+    double elapsed = (end.tv_sec - begin.tv_sec)
+        + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    unsigned long long count = (unsigned long long) nbuffers * length;
+    printf("%s: %zu buffers grown to %zu bytes, %.3f sec, %.0f reallocs/sec, %llu moves\n",
+           name, nbuffers, length, elapsed, count / elapsed, moves);
+}
@@ -0,0 +1,51 @@
+#include "m61.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+// bench-small: Measure memory use for many small live objects.
+//
+// Allocates COUNT objects of SIZE bytes, keeps them all alive, and reports
+// the elapsed time and the peak resident set size. Build with and without
+// `COMPACT=1` to compare metadata overhead.
+
+int main(int argc, char** argv) {
+    if (argc > 1 && (strcmp(argv[1], "-h") == 0
+                     || strcmp(argv[1], "--help") == 0)) {
+        printf("Usage: %s [COUNT [SIZE]]\n\
+\n\
+  Keep COUNT objects (default 10000000) of SIZE bytes (default 32) alive.\n", argv[0]);
+        exit(0);
+    }
+    // use the system allocator, not the base allocator
+    // (the base allocator can be slow)
+    base_malloc_disable(1);
+
+    unsigned long long count = argc > 1 ? strtoull(argv[1], 0, 0) : 10000000;
+    size_t size = argc > 2 ? strtoul(argv[2], 0, 0) : 32;
+    if (count == 0) {
+        fprintf(stderr, "%s: COUNT must be positive\n", argv[0]);
+        exit(1);
+    }
+
+    char** ptrs = (char**) calloc(count, sizeof(char*));
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (unsigned long long i = 0; i < count; ++i) {
+        ptrs[i] = (char*) malloc(size);
+        memset(ptrs[i], 0, size);
+    }
+    for (unsigned long long i = 0; i < count; ++i) {
+        free(ptrs[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(ptrs);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double elapsed = (end.tv_sec - begin.tv_sec)
+        + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    printf("%s: %llu objects of %zu bytes, %.3f sec, maxrss %ld KiB (%.1f bytes/object)\n",
+           argv[0], count, size, elapsed, usage.ru_maxrss,
+           usage.ru_maxrss * 1024.0 / count);
+}
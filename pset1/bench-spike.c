@@ -0,0 +1,82 @@
+#include "m61.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+// bench-spike: Report RSS over time through spikes of large allocations.
+//
+// Each round allocates and touches N blocks of SIZE bytes, frees them,
+// then runs a while on small allocations, printing the resident set size
+// after each phase. Uses the real base allocator, which keeps what it is
+// given, so without m61's mapped path RSS never comes down after a spike.
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static double rss_mib(void) {
+    unsigned long size = 0, resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%lu %lu", &size, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * (double) sysconf(_SC_PAGESIZE) / (1 << 20);
+}
+
+int main(int argc, char** argv) {
+    const char* name = argv[0];
+    if (argc > 1 && (strcmp(argv[1], "-h") == 0
+                     || strcmp(argv[1], "--help") == 0)) {
+        printf("Usage: %s [-n] [ROUNDS [N [SIZE]]]\n\
+\n\
+  ROUNDS times (default 3), allocate and touch N blocks (default 100) of\n\
+  SIZE bytes (default 1048576), free them, and make small allocations,\n\
+  printing RSS after each phase.\n\
+\n\
+  -n turns off the mapped path for large blocks.\n", argv[0]);
+        exit(0);
+    }
+    if (argc > 1 && strcmp(argv[1], "-n") == 0) {
+        m61_set_mmap_threshold(0);
+        --argc, ++argv;
+    }
+    unsigned long rounds = argc > 1 ? strtoul(argv[1], 0, 0) : 3;
+    size_t n = argc > 2 ? strtoul(argv[2], 0, 0) : 100;
+    size_t size = argc > 3 ? strtoul(argv[3], 0, 0) : 1 << 20;
+    if (rounds == 0 || n == 0 || size == 0) {
+        fprintf(stderr, "%s: arguments must be positive\n", name);
+        exit(1);
+    }
+
+    char** ptrs = (char**) calloc(n, sizeof(char*));
+    void* small[1000] = {NULL};
+    double begin = now();
+    printf("%s: %lu rounds of %zu x %zu bytes\n", name, rounds, n, size);
+    printf("  %8s  %-7s  %9s\n", "time", "phase", "RSS MiB");
+    printf("  %7.3fs  %-7s  %9.1f\n", now() - begin, "start", rss_mib());
+    for (unsigned long r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < n; ++i) {
+            ptrs[i] = (char*) malloc(size);
+            memset(ptrs[i], 1, size);
+        }
+        printf("  %7.3fs  %-7s  %9.1f\n", now() - begin, "spike", rss_mib());
+        for (size_t i = 0; i < n; ++i) {
+            free(ptrs[i]);
+        }
+        printf("  %7.3fs  %-7s  %9.1f\n", now() - begin, "release", rss_mib());
+        for (int i = 0; i < 100000; ++i) {
+            free(small[i % 1000]);
+            small[i % 1000] = malloc(1 + i % 256);
+        }
+        printf("  %7.3fs  %-7s  %9.1f\n", now() - begin, "small", rss_mib());
+    }
+    for (int i = 0; i < 1000; ++i) {
+        free(small[i]);
+    }
+    free(ptrs);
+}
@@ -0,0 +1,101 @@
+#include "m61.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+// bench-threads: Measure how m61 malloc/free scales with threads.
+//
+// Each of T threads keeps LIVE objects of 1 to MAXSIZE bytes alive and
+// repeatedly frees a random one and allocates a replacement, COUNT times
+// in total across threads. Runs T = 1, 2, 4, 8 and 16, with the per-thread
+// caches on and off, and prints allocations per second. Link against m61.o
+// (bench-threads) or m61-slab.o (bench-threads-slab) to compare backends.
+
+static unsigned long long count = 4000000;
+static size_t maxsize = 256;
+static size_t live = 1000;
+
+static void* thread_main(void* arg) {
+    unsigned long long x = (unsigned long long) (uintptr_t) arg * 0x9E3779B97F4A7C15ULL | 1;
+    unsigned long long n = *(unsigned long long*) arg;
+    void** ptrs = (void**) calloc(live, sizeof(void*));
+    for (unsigned long long i = 0; i < n; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        size_t slot = x % live;
+        free(ptrs[slot]);
+        ptrs[slot] = malloc(1 + (x >> 32) % maxsize);
+    }
+    for (size_t slot = 0; slot < live; ++slot) {
+        free(ptrs[slot]);
+    }
+    free(ptrs);
+    return NULL;
+}
+
+static double run(int nthreads) {
+    pthread_t threads[16];
+    unsigned long long per_thread[16];
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (int i = 0; i < nthreads; ++i) {
+        per_thread[i] = count / nthreads;
+        pthread_create(&threads[i], NULL, thread_main, &per_thread[i]);
+    }
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+}
+
+int main(int argc, char** argv) {
+    const char* name = argv[0];
+    int exact = 0;
+    if (argc > 1 && (strcmp(argv[1], "-h") == 0
+                     || strcmp(argv[1], "--help") == 0)) {
+        printf("Usage: %s [-b] [-x] [COUNT [MAXSIZE [LIVE]]]\n\
+\n\
+  Make COUNT allocations (default 4000000) of 1 to MAXSIZE bytes\n\
+  (default 256) split across 1 to 16 threads, each keeping LIVE objects\n\
+  (default 1000) alive.\n\
+\n\
+  Heavy hitters are sampled every 1 MiB, since exact counting takes a\n\
+  global lock on every allocation; -x counts them exactly.\n\
+  By default the base allocator passes through to the system allocator.\n\
+  -b keeps the real base allocator, whose free is slow.\n", argv[0]);
+        exit(0);
+    }
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        --argc, ++argv;
+    } else {
+        base_malloc_disable(1);
+    }
+    if (argc > 1 && strcmp(argv[1], "-x") == 0) {
+        exact = 1;
+        --argc, ++argv;
+    }
+    count = argc > 1 ? strtoull(argv[1], 0, 0) : count;
+    maxsize = argc > 2 ? strtoul(argv[2], 0, 0) : maxsize;
+    live = argc > 3 ? strtoul(argv[3], 0, 0) : live;
+    if (count == 0 || maxsize == 0 || live == 0) {
+        fprintf(stderr, "%s: arguments must be positive\n", name);
+        exit(1);
+    }
+    if (!exact) {
+        m61_set_sample_rate(1 << 20);
+    }
+
+    printf("%s: %llu allocations of 1-%zu bytes, %zu live per thread\n",
+           name, count, maxsize, live);
+    printf("threads      tcache allocs/sec    no tcache allocs/sec   ratio\n");
+    for (int nthreads = 1; nthreads <= 16; nthreads *= 2) {
+        m61_set_tcache(64);
+        double cached = run(nthreads);
+        m61_set_tcache(0);
+        double uncached = run(nthreads);
+        printf("%7d  %22.0f  %22.0f  %6.2fx\n", nthreads,
+               count / cached, count / uncached, uncached / cached);
+    }
+}
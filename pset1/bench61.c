@@ -0,0 +1,686 @@
+#define M61_DISABLE 1
+#include "m61.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+// bench61: Replay allocation workloads against several allocators.
+//
+// Each run replays one workload against one allocator in a child process
+// (so peak RSS is per run) and prints one line of JSON with ops/sec,
+// p50/p99/p999 latency for each kind of operation, and peak RSS. With no
+// -a or -w options, every workload runs against every allocator.
+//
+// Workloads:
+//   uniform    random frees and allocations of 1-512 bytes, LIVE slots
+//   powerlaw   like uniform, but sizes follow a power law (8 B - 1 MiB)
+//   prodcons   one thread allocates, another frees, through a FIFO queue
+//   realloc    LIVE buffers grown by realloc in 1-64 byte steps to 64 KiB
+//   trace      the events of an m61 trace file (-t FILE), all threads
+//              merged in timestamp order and replayed by one thread
+//
+// Allocators:
+//   malloc     the system allocator
+//   m61        m61 over base_malloc
+//   m61-sys    m61 over the system allocator (base_malloc disabled)
+// bench61 links m61.o and bench61-slab links m61-slab.o, so running both
+// compares backends.
+//
+// Latencies are measured with the TSC where available (calibrated against
+// CLOCK_MONOTONIC) and include about 10 ns of timer overhead. ops/sec
+// counts only time spent in allocator calls, not the memset that touches
+// each new block.
+
+#define OP_MALLOC 0
+#define OP_FREE 1
+#define OP_REALLOC 2
+#define NOPKINDS 3
+static const char* op_names[NOPKINDS] = {"malloc", "free", "realloc"};
+
+typedef struct op {
+    uint32_t slot;
+    uint32_t size;
+    uint8_t kind;
+} op;
+
+typedef struct allocator {
+    const char* name;
+    void* (*malloc)(size_t sz);
+    void (*free)(void* ptr);
+    void* (*realloc)(void* ptr, size_t sz);
+    int disable_base;                   // pass base_malloc to malloc?
+} allocator;
+
+static void* sys_malloc(size_t sz) {
+    return malloc(sz);
+}
+static void sys_free(void* ptr) {
+    free(ptr);
+}
+static void* sys_realloc(void* ptr, size_t sz) {
+    return realloc(ptr, sz);
+}
+static void* bench_m61_malloc(size_t sz) {
+    return m61_malloc(sz, __FILE__, __LINE__);
+}
+static void bench_m61_free(void* ptr) {
+    m61_free(ptr, __FILE__, __LINE__);
+}
+static void* bench_m61_realloc(void* ptr, size_t sz) {
+    return m61_realloc(ptr, sz, __FILE__, __LINE__);
+}
+
+static const allocator allocators[] = {
+    {"malloc", sys_malloc, sys_free, sys_realloc, 1},
+    {"m61", bench_m61_malloc, bench_m61_free, bench_m61_realloc, 0},
+    {"m61-sys", bench_m61_malloc, bench_m61_free, bench_m61_realloc, 1}
+};
+#define NALLOCATORS (sizeof(allocators) / sizeof(allocators[0]))
+
+static const char* workloads[] = {
+    "uniform", "powerlaw", "prodcons", "realloc", "trace"
+};
+#define NWORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+// benchmark parameters
+static size_t nops = 1000000;
+static size_t nlive = 4096;
+static const char* trace_filename = NULL;
+
+static unsigned long long bench_random(void) {
+    static __thread unsigned long long x = 88172645463325252ULL;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+}
+
+// uniform in (0, 1]
+static double bench_uniform(void) {
+    return ((bench_random() >> 11) + 1) * 0x1.0p-53;
+}
+
+
+// timing
+// ticks come from the TSC where there is one, else CLOCK_MONOTONIC ns
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return monotonic_ns();
+#endif
+}
+
+// latency histogram: exact below 16 ticks, then 16 buckets per power of
+// two (within 6.25%)
+#define HIST_BUCKETS 1024
+
+typedef struct histogram {
+    unsigned long long count;
+    unsigned long long total;           // sum of all latencies
+    unsigned long long bucket[HIST_BUCKETS];
+} histogram;
+
+static inline void hist_add(histogram* h, uint64_t v) {
+    unsigned idx;
+    if (v < 16) {
+        idx = v;
+    } else {
+        int e = 63 - __builtin_clzll(v);
+        idx = (e - 3) * 16 + ((v >> (e - 4)) & 15);
+    }
+    ++h->bucket[idx];
+    ++h->count;
+    h->total += v;
+}
+
+static void hist_merge(histogram* h, const histogram* other) {
+    h->count += other->count;
+    h->total += other->total;
+    for (int i = 0; i < HIST_BUCKETS; ++i) {
+        h->bucket[i] += other->bucket[i];
+    }
+}
+
+// smallest value of bucket `idx`
+static uint64_t hist_value(unsigned idx) {
+    if (idx < 16) {
+        return idx;
+    }
+    unsigned e = idx / 16 + 3;
+    return (uint64_t) (16 + idx % 16) << (e - 4);
+}
+
+// the latency below which fraction `q` of samples fall
+static uint64_t hist_quantile(const histogram* h, double q) {
+    unsigned long long want = (unsigned long long) ceil(q * h->count);
+    unsigned long long seen = 0;
+    for (unsigned i = 0; i < HIST_BUCKETS; ++i) {
+        seen += h->bucket[i];
+        if (seen >= want && seen > 0) {
+            return hist_value(i);
+        }
+    }
+    return 0;
+}
+
+
+// workload generation
+
+// a power-law size in [8, 1 MiB]: P(size > x) ~ x^-1.5
+static uint32_t powerlaw_size(void) {
+    double sz = 8 * pow(bench_uniform(), -1 / 1.5);
+    return sz > (1 << 20) ? 1 << 20 : (uint32_t) sz;
+}
+
+// random frees and allocations: each op picks a slot, and frees it if
+// it is live or fills it if it is not
+static op* make_random(size_t* n, size_t* nslots, int powerlaw) {
+    op* ops = malloc(nops * sizeof(op));
+    char* live = calloc(nlive, 1);
+    for (size_t i = 0; i < nops; ++i) {
+        uint32_t slot = bench_random() % nlive;
+        ops[i].slot = slot;
+        if (live[slot]) {
+            ops[i].kind = OP_FREE;
+            ops[i].size = 0;
+        } else {
+            ops[i].kind = OP_MALLOC;
+            ops[i].size = powerlaw ? powerlaw_size() : 1 + bench_random() % 512;
+        }
+        live[slot] = !live[slot];
+    }
+    free(live);
+    *n = nops;
+    *nslots = nlive;
+    return ops;
+}
+
+// buffers grown by realloc a few bytes at a time, like a vector; each
+// op grows a random buffer, and a buffer that reaches 64 KiB is freed
+static op* make_realloc(size_t* n, size_t* nslots) {
+    op* ops = malloc(nops * sizeof(op));
+    uint32_t* sizes = calloc(nlive, sizeof(uint32_t));
+    for (size_t i = 0; i < nops; ++i) {
+        uint32_t slot = bench_random() % nlive;
+        ops[i].slot = slot;
+        if (sizes[slot] >= (64 << 10)) {
+            ops[i].kind = OP_FREE;
+            sizes[slot] = 0;
+        } else {
+            ops[i].kind = sizes[slot] ? OP_REALLOC : OP_MALLOC;
+            sizes[slot] += 1 + bench_random() % 64;
+        }
+        ops[i].size = sizes[slot];
+    }
+    free(sizes);
+    *n = nops;
+    *nslots = nlive;
+    return ops;
+}
+
+
+// trace replay
+
+typedef struct trace_event {
+    uint64_t time;
+    uint64_t seq;                       // position in the file, for ties
+    uintptr_t addr;
+    uintptr_t old_addr;
+    uint32_t size;
+    uint8_t kind;
+} trace_event;
+
+typedef struct trace_reader {
+    const unsigned char* p;
+    const unsigned char* end;
+    int bad;
+} trace_reader;
+
+static uint64_t trace_get(trace_reader* r) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (r->p == r->end) {
+            r->bad = 1;
+            return 0;
+        }
+        unsigned char b = *r->p++;
+        v |= (uint64_t) (b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return v;
+        }
+    }
+    r->bad = 1;
+    return v;
+}
+
+static int64_t trace_get_delta(trace_reader* r) {
+    uint64_t z = trace_get(r);
+    return (int64_t) (z >> 1) ^ -(int64_t) (z & 1);
+}
+
+static int compare_events(const void* a, const void* b) {
+    const trace_event* x = a;
+    const trace_event* y = b;
+    if (x->time != y->time) {
+        return x->time < y->time ? -1 : 1;
+    }
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+// read every event of an m61 trace, sorted by time
+static trace_event* read_trace(const char* filename, size_t* nevents) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) {
+        perror(filename);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char* data = malloc(len > 0 ? len : 1);
+    if (len < 8 || fread(data, 1, len, f) != (size_t) len
+        || memcmp(data, M61_TRACE_MAGIC, 8) != 0) {
+        fprintf(stderr, "%s: not an m61 trace\n", filename);
+        exit(1);
+    }
+    fclose(f);
+
+    size_t n = 0, capacity = 4096;
+    trace_event* events = malloc(capacity * sizeof(trace_event));
+    size_t pos = 8;
+    while (len - pos >= 8) {
+        uint32_t block_len = data[pos + 4] | data[pos + 5] << 8
+            | data[pos + 6] << 16 | (uint32_t) data[pos + 7] << 24;
+        if (block_len > len - pos - 8) {
+            break;
+        }
+        trace_reader r = {data + pos + 8, data + pos + 8 + block_len, 0};
+        uintptr_t addr = 0;
+        uint64_t time = 0;
+        while (r.p < r.end && !r.bad) {
+            int kind = *r.p++;
+            if (kind == M61_TRACE_SITE) {
+                trace_get(&r);
+                trace_get(&r);
+                size_t name_len = trace_get(&r);
+                r.p += name_len <= (size_t) (r.end - r.p) ? name_len : 0;
+                continue;
+            }
+            trace_get(&r);              // site
+            uint32_t size = trace_get(&r);
+            if (kind == M61_TRACE_REALLOC) {
+                trace_get(&r);          // old size
+            }
+            addr += trace_get_delta(&r);
+            uintptr_t old_addr = 0;
+            if (kind == M61_TRACE_REALLOC) {
+                old_addr = addr + trace_get_delta(&r);
+            }
+            time += trace_get(&r);
+            if (n == capacity) {
+                capacity *= 2;
+                events = realloc(events, capacity * sizeof(trace_event));
+            }
+            events[n].time = time;
+            events[n].seq = n;
+            events[n].addr = addr;
+            events[n].old_addr = old_addr;
+            events[n].size = size;
+            events[n].kind = kind;
+            ++n;
+        }
+        pos += 8 + block_len;
+    }
+    free(data);
+    qsort(events, n, sizeof(trace_event), compare_events);
+    *nevents = n;
+    return events;
+}
+
+// map from traced block address to slot number (open addressing,
+// linear probing, backward-shift deletion)
+typedef struct slot_map {
+    uintptr_t* addr;
+    uint32_t* slot;
+    size_t mask;
+} slot_map;
+
+static size_t slot_map_find(slot_map* m, uintptr_t addr) {
+    size_t i = (addr * 0x9E3779B97F4A7C15ULL >> 20) & m->mask;
+    while (m->addr[i] && m->addr[i] != addr) {
+        i = (i + 1) & m->mask;
+    }
+    return i;
+}
+
+static void slot_map_remove(slot_map* m, size_t i) {
+    m->addr[i] = 0;
+    size_t j = i;
+    while (1) {
+        j = (j + 1) & m->mask;
+        if (!m->addr[j]) {
+            return;
+        }
+        size_t home = (m->addr[j] * 0x9E3779B97F4A7C15ULL >> 20) & m->mask;
+        if (((j - home) & m->mask) >= ((j - i) & m->mask)) {
+            m->addr[i] = m->addr[j];
+            m->slot[i] = m->slot[j];
+            m->addr[j] = 0;
+            i = j;
+        }
+    }
+}
+
+// turn a trace into ops on slots. Frees of blocks allocated before the
+// trace started are dropped.
+static op* make_trace(size_t* n, size_t* nslots) {
+    if (!trace_filename) {
+        fprintf(stderr, "bench61: the trace workload needs -t FILE\n");
+        exit(1);
+    }
+    size_t nevents;
+    trace_event* events = read_trace(trace_filename, &nevents);
+    op* ops = malloc((nevents ? nevents : 1) * sizeof(op));
+    slot_map m;
+    m.mask = 1023;
+    while (m.mask < 2 * nevents) {
+        m.mask = 2 * m.mask + 1;
+    }
+    m.addr = calloc(m.mask + 1, sizeof(uintptr_t));
+    m.slot = calloc(m.mask + 1, sizeof(uint32_t));
+    uint32_t* free_slots = malloc((nevents ? nevents : 1) * sizeof(uint32_t));
+    size_t nfree_slots = 0;
+    uint32_t next_slot = 0;
+    size_t k = 0;
+
+    for (size_t i = 0; i < nevents; ++i) {
+        trace_event* e = &events[i];
+        uintptr_t freed = e->kind == M61_TRACE_FREE ? e->addr
+            : e->kind == M61_TRACE_REALLOC ? e->old_addr : 0;
+        uintptr_t allocated = e->kind == M61_TRACE_FREE ? 0 : e->addr;
+        int have_old = 0;
+        uint32_t slot = 0;
+        if (freed) {
+            size_t idx = slot_map_find(&m, freed);
+            if (m.addr[idx]) {
+                have_old = 1;
+                slot = m.slot[idx];
+                slot_map_remove(&m, idx);
+            }
+        }
+        if (have_old && allocated) {
+            ops[k].kind = OP_REALLOC;
+        } else if (have_old) {
+            ops[k].kind = OP_FREE;
+            free_slots[nfree_slots++] = slot;
+        } else if (allocated) {
+            ops[k].kind = OP_MALLOC;
+            slot = nfree_slots ? free_slots[--nfree_slots] : next_slot++;
+        } else {
+            continue;
+        }
+        if (allocated) {
+            size_t idx = slot_map_find(&m, allocated);
+            if (!m.addr[idx]) {
+                m.addr[idx] = allocated;
+                m.slot[idx] = slot;
+            }
+        }
+        ops[k].slot = slot;
+        ops[k].size = e->size;
+        ++k;
+    }
+    free(free_slots);
+    free(m.addr);
+    free(m.slot);
+    free(events);
+    *n = k;
+    *nslots = next_slot ? next_slot : 1;
+    return ops;
+}
+
+
+// running a workload
+
+typedef struct result {
+    histogram hist[NOPKINDS];
+} result;
+
+// replay `ops` with one thread; all blocks still live at the end are freed
+static void replay(const allocator* a, op* ops, size_t n, size_t nslots,
+                   result* res) {
+    void** slots = calloc(nslots, sizeof(void*));
+    uint32_t* sizes = calloc(nslots, sizeof(uint32_t));
+    for (size_t i = 0; i < n; ++i) {
+        op* o = &ops[i];
+        void* p;
+        uint64_t t0 = ticks();
+        if (o->kind == OP_MALLOC) {
+            p = a->malloc(o->size);
+        } else if (o->kind == OP_FREE) {
+            a->free(slots[o->slot]);
+            p = NULL;
+        } else {
+            p = a->realloc(slots[o->slot], o->size);
+        }
+        hist_add(&res->hist[o->kind], ticks() - t0);
+        // touch the new bytes, as a program would
+        if (p && o->size > sizes[o->slot]) {
+            memset((char*) p + sizes[o->slot], 0xA5, o->size - sizes[o->slot]);
+        }
+        slots[o->slot] = p;
+        sizes[o->slot] = p ? o->size : 0;
+    }
+    for (size_t s = 0; s < nslots; ++s) {
+        a->free(slots[s]);
+    }
+    free(slots);
+    free(sizes);
+}
+
+// producer/consumer: blocks pass from the allocating thread to the
+// freeing thread through a single-producer single-consumer ring
+#define RING_SIZE 4096
+
+typedef struct prodcons {
+    const allocator* a;
+    void* ring[RING_SIZE];
+    size_t head;                        // next slot to fill (producer)
+    size_t tail;                        // next slot to drain (consumer)
+    histogram hist;
+} prodcons;
+
+static void* producer(void* arg) {
+    prodcons* pc = arg;
+    for (size_t i = 0; i < nops / 2; ++i) {
+        size_t sz = 16 + bench_random() % 1009;
+        uint64_t t0 = ticks();
+        void* p = pc->a->malloc(sz);
+        hist_add(&pc->hist, ticks() - t0);
+        memset(p, 0xA5, sz);
+        while (i - __atomic_load_n(&pc->tail, __ATOMIC_ACQUIRE) >= RING_SIZE) {
+            sched_yield();
+        }
+        pc->ring[i % RING_SIZE] = p;
+        __atomic_store_n(&pc->head, i + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void run_prodcons(const allocator* a, result* res) {
+    prodcons* pc = calloc(1, sizeof(prodcons));
+    pc->a = a;
+    pthread_t t;
+    pthread_create(&t, NULL, producer, pc);
+    for (size_t i = 0; i < nops / 2; ++i) {
+        while (__atomic_load_n(&pc->head, __ATOMIC_ACQUIRE) == i) {
+            sched_yield();
+        }
+        void* p = pc->ring[i % RING_SIZE];
+        __atomic_store_n(&pc->tail, i + 1, __ATOMIC_RELEASE);
+        uint64_t t0 = ticks();
+        a->free(p);
+        hist_add(&res->hist[OP_FREE], ticks() - t0);
+    }
+    pthread_join(t, NULL);
+    hist_merge(&res->hist[OP_MALLOC], &pc->hist);
+    free(pc);
+}
+
+static long maxrss_kb(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// run one workload against one allocator and print a JSON result line
+static void run(const allocator* a, const char* workload, const char* bench) {
+    size_t n = 0, nslots = 0;
+    op* ops = NULL;
+    if (strcmp(workload, "uniform") == 0) {
+        ops = make_random(&n, &nslots, 0);
+    } else if (strcmp(workload, "powerlaw") == 0) {
+        ops = make_random(&n, &nslots, 1);
+    } else if (strcmp(workload, "realloc") == 0) {
+        ops = make_realloc(&n, &nslots);
+    } else if (strcmp(workload, "trace") == 0) {
+        ops = make_trace(&n, &nslots);
+    } else if (strcmp(workload, "prodcons") != 0) {
+        fprintf(stderr, "bench61: unknown workload %s\n", workload);
+        exit(1);
+    }
+    if (a->disable_base) {
+        base_malloc_disable(1);
+    }
+
+    result* res = calloc(1, sizeof(result));
+    long baseline_rss = maxrss_kb();
+    uint64_t ns0 = monotonic_ns(), t0 = ticks();
+    if (ops) {
+        replay(a, ops, n, nslots, res);
+    } else {
+        run_prodcons(a, res);
+    }
+    uint64_t ns1 = monotonic_ns(), t1 = ticks();
+    long rss = maxrss_kb();
+    double ns_per_tick = t1 > t0 ? (double) (ns1 - ns0) / (t1 - t0) : 1;
+
+    unsigned long long count = 0, total = 0;
+    for (int k = 0; k < NOPKINDS; ++k) {
+        count += res->hist[k].count;
+        total += res->hist[k].total;
+    }
+    printf("{\"bench\":\"%s\", \"allocator\":\"%s\", \"workload\":\"%s\", \"ops\":%llu, \"time\":%.6f, \"ops_per_sec\":%.0f",
+           bench, a->name, workload, count, (ns1 - ns0) / 1e9,
+           total ? count / (total * ns_per_tick / 1e9) : 0.0);
+    for (int k = 0; k < NOPKINDS; ++k) {
+        const histogram* h = &res->hist[k];
+        if (h->count) {
+            printf(", \"%s\":{\"count\":%llu, \"p50_ns\":%.0f, \"p99_ns\":%.0f, \"p999_ns\":%.0f}",
+                   op_names[k], h->count,
+                   hist_quantile(h, 0.5) * ns_per_tick,
+                   hist_quantile(h, 0.99) * ns_per_tick,
+                   hist_quantile(h, 0.999) * ns_per_tick);
+        }
+    }
+    printf(", \"maxrss\":%ld, \"baseline_rss\":%ld}\n", rss, baseline_rss);
+    fflush(stdout);
+    free(res);
+    free(ops);
+}
+
+// run in a child process, so that each run has its own peak RSS
+static int run_child(const allocator* a, const char* workload,
+                     const char* bench) {
+    fflush(stdout);
+    pid_t p = fork();
+    if (p == 0) {
+        run(a, workload, bench);
+        exit(0);
+    }
+    int status;
+    if (p < 0 || waitpid(p, &status, 0) != p
+        || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "bench61: %s/%s failed\n", a->name, workload);
+        return 1;
+    }
+    return 0;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-a ALLOCATOR] [-w WORKLOAD] [-n OPS] [-l LIVE] [-t TRACEFILE]\n\
+\n\
+  Replay WORKLOAD (uniform, powerlaw, prodcons, realloc or trace; default\n\
+  all but trace, plus trace if -t is given) against ALLOCATOR (malloc, m61\n\
+  or m61-sys; default all). OPS is the number of operations (default\n\
+  1000000), LIVE the number of slots for live blocks (default 4096).\n\
+  Prints one JSON line per run.\n", name);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    const char* only_allocator = NULL;
+    const char* only_workload = NULL;
+    int ch;
+    while ((ch = getopt(argc, argv, "a:w:n:l:t:h")) != -1) {
+        switch (ch) {
+        case 'a':
+            only_allocator = optarg;
+            break;
+        case 'w':
+            only_workload = optarg;
+            break;
+        case 'n':
+            nops = strtoul(optarg, 0, 0);
+            break;
+        case 'l':
+            nlive = strtoul(optarg, 0, 0);
+            break;
+        case 't':
+            trace_filename = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc || nops == 0 || nlive == 0) {
+        usage(argv[0]);
+    }
+    const char* bench = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+
+    int status = 0, any = 0;
+    for (size_t w = 0; w < NWORKLOADS; ++w) {
+        if (only_workload ? strcmp(only_workload, workloads[w]) != 0
+            : strcmp(workloads[w], "trace") == 0 && !trace_filename) {
+            continue;
+        }
+        for (size_t i = 0; i < NALLOCATORS; ++i) {
+            if (!only_allocator || strcmp(only_allocator, allocators[i].name) == 0) {
+                status |= run_child(&allocators[i], workloads[w], bench);
+                any = 1;
+            }
+        }
+    }
+    if (!any) {
+        usage(argv[0]);
+    }
+    return status;
+}
@@ -3,6 +3,8 @@
 #include <math.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+#include <assert.h>
 #define NALLOCATORS 40
 // hhtest: A sample framework for evaluating heavy hitter reports.
 
@@ -97,6 +99,98 @@ static void phase(double skew, unsigned long long count) {
     }
 }
 
+static const char synthetic_file[] = "synthetic.c";
+
+// Call m61_malloc from `nsites` synthetic call sites (same file, lines
+// 1..nsites) `count` times and time how long the allocations take. This
+// measures the heavy hitter lookup cost when there are many sites.
+// Site I is picked with probability proportional to 1/(I+1)^skew and
+// allocates 1 + I % 64 bytes. Exact per-site byte counts are kept on the
+// side and compared against the heavy hitter sketch, which must bracket
+// the truth and stay within its error bound of (total bytes) / k.
+static void sites_phase(int nsites, unsigned long long count, double skew,
+                        size_t k) {
+    double* limit = (double*) malloc(nsites * sizeof(double));
+    unsigned long long* exact = (unsigned long long*)
+        calloc(nsites + 1, sizeof(unsigned long long));
+    double sum_p = 0;
+    for (int i = 0; i < nsites; ++i) {
+        sum_p += pow(i + 1, -skew);
+        limit[i] = sum_p;
+    }
+    m61_heavyhitter_init(k);
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    unsigned long long total = 0;
+    for (unsigned long long i = 0; i < count; ++i) {
+        double x = sum_p * random() / RAND_MAX;
+        int lo = 0, hi = nsites - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (x > limit[mid]) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        int line = lo + 1;
+        size_t sz = 1 + lo % 64;
+        void* ptr = m61_malloc(sz, synthetic_file, line);
+        m61_free(ptr, synthetic_file, line);
+        exact[line] += sz;
+        total += sz;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - begin.tv_sec)
+        + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    printf("SITES: %d sites, %llu allocations, %.3f sec, %.1f ns/allocation\n",
+           nsites, count, elapsed, elapsed * 1e9 / count);
+
+    // check the sketch against the exact counts
+    struct m61_heavyhitter* hh = (struct m61_heavyhitter*)
+        malloc(k * sizeof(struct m61_heavyhitter));
+    size_t n = m61_getheavyhitters(hh, k);
+    char* monitored = (char*) calloc(nsites + 1, 1);
+    if (m61_get_sample_rate() != 0) {
+        // sampled estimates are unbiased, not bounds; show the largest
+        for (size_t i = 0, shown = 0; i < n && shown < 5; ++i) {
+            if (hh[i].file == synthetic_file) {
+                printf("SAMPLED: line %d: estimate %llu bytes, exact %llu bytes\n",
+                       hh[i].line, hh[i].size, exact[hh[i].line]);
+                ++shown;
+            }
+        }
+    } else {
+        unsigned long long bound = total / k, max_error = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (hh[i].file != synthetic_file) {
+                continue;
+            }
+            assert(hh[i].line >= 1 && hh[i].line <= nsites);
+            unsigned long long truth = exact[hh[i].line];
+            assert(hh[i].size >= truth);
+            assert(hh[i].size - hh[i].error <= truth);
+            assert(hh[i].error <= bound);
+            if (hh[i].size - truth > max_error) {
+                max_error = hh[i].size - truth;
+            }
+            monitored[hh[i].line] = 1;
+        }
+        // every site bigger than the bound must be monitored
+        for (int line = 1; line <= nsites; ++line) {
+            assert(exact[line] <= bound || monitored[line]);
+        }
+        printf("SKETCH: %zu counters, %zu monitored, max error %llu bytes, bound %llu bytes\n",
+               k, n, max_error, bound);
+    }
+
+    free(monitored);
+    free(hh);
+    free(exact);
+    free(limit);
+}
+
 int main(int argc, char **argv) {
     // use the system allocator, not the base allocator
     // (the base allocator can be slow)
@@ -107,6 +201,7 @@ int main(int argc, char **argv) {
         printf("Usage: ./hhtest\n\
        OR ./hhtest SKEW [COUNT]\n\
        OR ./hhtest SKEW1 COUNT1 SKEW2 COUNT2 ...\n\
+       OR ./hhtest -sites NSITES [COUNT [SKEW [K]]]\n\
 \n\
   Each SKEW is a real number. 0 means each allocator is called equally\n\
   frequently. 1 means the first allocator is called twice as much as the\n\
@@ -116,7 +211,38 @@ int main(int argc, char **argv) {
   The default is 1000000.\n\
 \n\
   If you give multiple SKEW COUNT pairs, then ./hhtest runs several\n\
-  allocation phases in order.\n");
+  allocation phases in order.\n\
+\n\
+  -sites spreads COUNT allocations over NSITES synthetic call sites\n\
+  (default 10000), Zipf-distributed with exponent SKEW (default 0), and\n\
+  times the heavy hitter lookup. It then checks a K-counter sketch\n\
+  (default 1024) against exact per-site counts.\n");
+        exit(0);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "-sites") == 0) {
+        int nsites = 10000;
+        if (argc > 2) {
+            nsites = strtol(argv[2], 0, 0);
+        }
+        unsigned long long count = 1000000;
+        if (argc > 3) {
+            count = strtoull(argv[3], 0, 0);
+        }
+        double skew = 0;
+        if (argc > 4) {
+            skew = strtod(argv[4], 0);
+        }
+        size_t k = 1024;
+        if (argc > 5) {
+            k = strtoul(argv[5], 0, 0);
+        }
+        if (nsites <= 0 || count == 0 || k == 0) {
+            fprintf(stderr, "hhtest: NSITES, COUNT, and K must be positive\n");
+            exit(1);
+        }
+        sites_phase(nsites, count, skew, k);
+        m61_heavyHitterTest();
         exit(0);
     }
 
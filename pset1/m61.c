@@ -1,4 +1,7 @@
 #define M61_DISABLE 1
+#if M61_PRELOAD
+#define _GNU_SOURCE 1 // dladdr1, program_invocation_short_name
+#endif
 #include "m61.h"
 #include <stdlib.h>
 #include <string.h>
@@ -6,21 +9,78 @@
 #include <inttypes.h>
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <execinfo.h>
+#if M61_PRELOAD
+#include <errno.h>
+#include <dlfcn.h>
+#include <link.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
-// keep track of stats
-struct m61_statistics global_stats;
+// Building with M61_COMPACT=1 (`make COMPACT=1`) shrinks the metadata in
+// front of every block from 64 to 16 bytes. The call site becomes an index
+// into the interned site table, the address check and active flag fold into
+// one tagged state word, and active blocks are tracked in the live map (a
+// side table) instead of a linked list threaded through the metadata.
+#ifndef M61_COMPACT
+#define M61_COMPACT 0
+#endif
+
+// Building with M61_LEVEL=n (`make LEVEL=n`) compiles whole subsystems out
+// of the allocation and free paths. Each level adds to the one below:
+//   0  statistics only
+//   1  memory bug checks: heap bounds, the live map (invalid and double
+//      frees), the metadata and overflow canary checks, quarantine and
+//      guard pages
+//   2  tracking: the active lists behind the leak report, and the heavy
+//      hitter sketch
+//   3  profiling: tracing, lifetime and stack sampling (the default)
+// The subsystems are tested with constant conditions, so disabled ones
+// cost no branches. Reports on a disabled subsystem come out empty.
+#ifndef M61_LEVEL
+#define M61_LEVEL 3
+#endif
+#define M61_CHECKS (M61_LEVEL >= 1)
+#define M61_TRACKING (M61_LEVEL >= 2)
+#define M61_PROFILING (M61_LEVEL >= 3)
 
+#if M61_COMPACT
+struct m61_metadata
+{
+    uint32_t size;       // number of bytes in allocation
+    uint32_t site : 16;  // index of the allocating file:line in m61_sites
+    uint32_t slack : 16; // usable bytes past `size` (see M61_MAXSLACK)
+    // stack id << 32 | state_tag(payload), | 1 if freed,
+    // | 2 if lifetime-sampled, | 4 if guarded, | 8 if aligned, | 16 if mapped
+    uint64_t state;
+};
+#define M61_MAXSLACK 0xFFFF
+#else
 struct m61_metadata
 {
     unsigned long long size;        // number of bytes in allocation
-    unsigned long long active_flag; // if equal to 1111 if allocation is not 'active'
+    unsigned active_flag;           // 1111 if the allocation is not active
+    uint32_t stack;                 // sampled backtrace id in m61_stacks, or 0
     char *ptr_addr;                 // address of the pointer to the allocation
     const char *file;               // file in which allocation was called
     int line;                       // line in which allocation was called
-    struct m61_metadata *prev;      // pointer to previous node in doubly linked list
-    struct m61_metadata *next;      // pointer to next node in doubly linked list
-    int padding;                    // padding to keep struct with 8-bit alignment
+    unsigned sampled : 1;           // 1 if the lifetime is being sampled
+    unsigned guarded : 1;           // 1 if the block sits against a guard page
+    unsigned aligned : 1;           // 1 if padding precedes the metadata
+    unsigned mapped : 1;            // 1 if the block has its own mapping
+    struct m61_metadata *prev;      // previous node in doubly linked list
+    struct m61_metadata *next;      // next node in doubly linked list
+    unsigned long long slack;       // usable bytes past `size`, for realloc
 };
+#define M61_MAXSLACK ((size_t)-1)
+#endif
 
 // To check for boundary write errors
 typedef struct m61_overflow_buffer
@@ -28,305 +88,4760 @@ typedef struct m61_overflow_buffer
     unsigned long long buffer; // overflow checker
 } m61_overflow_buffer;
 
-struct m61_metadata *head = NULL;
+// keep track of stats
+// each thread updates its own cache-line-aligned shard of counters, so
+// threads never contend on a shared counter. m61_getstatistics sums the
+// shards on demand. Only the owning thread writes a shard (a block freed
+// by another thread is subtracted from that thread's shard, which may wrap,
+// but the sum is still right). Shards of exited threads are reused.
+typedef struct m61_stats_shard
+{
+    struct m61_statistics stats;
+    struct m61_stats_shard *next;      // next shard in all_shards
+    struct m61_stats_shard *next_free; // next shard in free_shards
+    struct m61_quarantine *quarantine; // freed blocks held back from reuse
+    struct m61_trace_buffer *trace;    // trace records not yet written
+    struct m61_tcache *tcache;         // freed blocks cached for reuse
+    struct m61_hh_batch *hh;           // heavy hitter counts not yet merged
+    pthread_mutex_t hh_lock;           // guards hh, which any thread may merge
+    unsigned long long reserved;       // bytes held from base_malloc for blocks
+    unsigned id;                       // thread slot number, for traces
+} __attribute__((aligned(64))) m61_stats_shard;
+
+static m61_stats_shard *all_shards = NULL;  // every shard ever created
+static m61_stats_shard *free_shards = NULL; // shards of exited threads
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t shard_key;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+static __thread m61_stats_shard *my_shard = NULL;
+static unsigned nshards = 0;
 
-// create the struct in which we will store heavy hitter data
-typedef struct m61_heavyhitter_node
+static void trace_flush(m61_stats_shard *shard);
+static void tcache_flush(m61_stats_shard *shard);
+static void hh_batch_merge(m61_stats_shard *shard);
+static void hh_batch_merge_all(void);
+
+// add `delta` to a counter of this thread's shard; the relaxed store keeps
+// concurrent readers in m61_getstatistics well defined
+#define SHARD_ADD(shard, field, delta) \
+    __atomic_store_n(&(shard)->stats.field, (shard)->stats.field + (delta), __ATOMIC_RELAXED)
+
+// smallest and largest heap addresses, shared by all threads and only
+// updated (by compare-and-swap) when an allocation extends the range
+static char *heap_min = NULL;
+static char *heap_max = NULL;
+
+#if !M61_COMPACT
+// active allocations live in M61_STRIPES doubly linked lists, each with its
+// own lock; a block's stripe is picked by hashing its address
+#define M61_STRIPES 64
+
+typedef struct m61_active_stripe
 {
-    struct m61_heavyhitter_node *next;
-    const char *fileName;
-    int lineNumber;
-    int HHNum;
-    unsigned long long size;
-} m61_heavyhitter_node;
+    pthread_mutex_t lock;
+    struct m61_metadata *head;
+} __attribute__((aligned(64))) m61_active_stripe;
 
-// head of heavy hitter pointer linked list
-m61_heavyhitter_node *HH_Head = NULL;
+static m61_active_stripe active_stripes[M61_STRIPES] = {
+    [0 ... M61_STRIPES - 1] = {PTHREAD_MUTEX_INITIALIZER, NULL}};
+#endif
 
-// a global variable to store the total number of allocated bytes of all nodes
-// in the heavy hitter list
-unsigned long long HH_total_bytes = 0;
+// give a retired thread's shard to the next new thread
+static void release_shard(void *arg)
+{
+    m61_stats_shard *shard = arg;
+    trace_flush(shard);
+    tcache_flush(shard);
+    hh_batch_merge(shard);
+    pthread_mutex_lock(&shards_lock);
+    shard->next_free = free_shards;
+    free_shards = shard;
+    pthread_mutex_unlock(&shards_lock);
+    my_shard = NULL;
+}
+
+static void create_shard_key(void)
+{
+    pthread_key_create(&shard_key, release_shard);
+}
 
-// insert data for heavy hitter list
-// if previous line == current line, add the size
-// if not add info for the new size in the list
-void update_HHList(const char *file, int line, unsigned long long sz)
+// return this thread's stats shard, creating or reusing one on first use
+static m61_stats_shard *m61_shard(void)
 {
-    // set head to ptr
-    m61_heavyhitter_node *ptr = HH_Head;
-    // iterate through list
-    while (ptr != NULL)
+    if (my_shard)
+    {
+        return my_shard;
+    }
+    pthread_once(&shard_key_once, create_shard_key);
+    pthread_mutex_lock(&shards_lock);
+    m61_stats_shard *shard = free_shards;
+    if (shard)
+    {
+        free_shards = shard->next_free;
+    }
+    else
     {
-        // if line is within the list
-        if (ptr->fileName == file && ptr->lineNumber == line)
+        // base_malloc only guarantees 16-byte alignment
+        uintptr_t addr = (uintptr_t)base_malloc(sizeof(m61_stats_shard) + 63);
+        if (!addr)
         {
-            // update the fields
-            ptr->size += sz;
-            ptr->HHNum += 1;
-            HH_total_bytes += sz;
-            return;
+            abort();
         }
-        // move to the next pointer
-        ptr = ptr->next;
+        shard = (m61_stats_shard *)((addr + 63) & ~(uintptr_t)63);
+        memset(shard, 0, sizeof(m61_stats_shard));
+        pthread_mutex_init(&shard->hh_lock, NULL);
+        shard->id = nshards++;
+        shard->next = all_shards;
+        __atomic_store_n(&all_shards, shard, __ATOMIC_RELEASE);
     }
-
-    // if no data exists for the line and file add them to the front of the list
-    m61_heavyhitter_node *new = malloc(sizeof(m61_heavyhitter_node));
-    new->lineNumber = line;
-    new->fileName = file;
-    new->HHNum = 1;
-    new->size = sz;
-    new->next = HH_Head;
-    HH_Head = new;
-    HH_total_bytes += sz;
+    pthread_mutex_unlock(&shards_lock);
+    pthread_setspecific(shard_key, shard);
+    my_shard = shard;
+    return shard;
 }
 
-// void pointer gives us first address of this byte
-// get byte of memory of sz
-void *m61_malloc(size_t sz, const char *file, int line)
+// widen [heap_min, heap_max] to include [lo, hi]
+// kept at every level: the statistics report the bounds even when no
+// checks use them, and a new block rarely widens them, so this is
+// usually two loads
+static void update_heap_bounds(char *lo, char *hi)
 {
-    (void)file, (void)line; // avoid uninitialized variable warnings
-
-    // Prevent integer overflow: check to make sure sz not greater than 2^32-1
-    // 2^32-1 is maximum value for 32-bit unsigned Int. The -1 is because integers start at 0 but counting starts at 1
-    if (sz > (pow(2, 32) - 1) - sizeof(struct m61_statistics) - sizeof(m61_overflow_buffer))
+    char *cur = __atomic_load_n(&heap_min, __ATOMIC_RELAXED);
+    while ((!cur || lo < cur) &&
+           !__atomic_compare_exchange_n(&heap_min, &cur, lo, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
     {
-        global_stats.nfail++;
-        global_stats.fail_size += sz;
-        return NULL;
     }
-    // Add extra space to check for errors
-    m61_overflow_buffer buffer = {1111};
+    cur = __atomic_load_n(&heap_max, __ATOMIC_RELAXED);
+    while ((!cur || hi > cur) &&
+           !__atomic_compare_exchange_n(&heap_max, &cur, hi, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
 
-    // struct to hold metadata
-    struct m61_metadata metadata = {sz, 0, NULL, file, line, NULL, NULL, 0};
-    struct m61_metadata *ptr = NULL;
-    // create extra space for pointer for metadata and overflow checker
-    ptr = malloc(sizeof(struct m61_metadata) + sz + sizeof(m61_overflow_buffer));
+// count `delta` bytes of blocks, slabs or arena chunks taken from
+// (positive) or given back to base_malloc, for the fragmentation report
+static void note_reserved(long long delta)
+{
+    m61_stats_shard *shard = m61_shard();
+    __atomic_store_n(&shard->reserved, shard->reserved + delta, __ATOMIC_RELAXED);
+}
 
-    // update pointer address
-    metadata.ptr_addr = (char *)(ptr + 1);
+// hash a call site (file pointer, line)
+static uint64_t hash_site(const char *file, int line)
+{
+    uint64_t h = ((uintptr_t)file >> 3) ^ ((uint64_t)(unsigned)line << 32);
+    h *= 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 29);
+}
 
-    // put data into metadata
-    *ptr = metadata;
+// interned call sites
+// each distinct file:line gets a small id the first time it allocates
+// (compact metadata stores it) or is traced.
+// Lookups are lock-free: an id is published in m61_site_index only after
+// its m61_sites entry is written. Site 0 stands for every site past
+// M61_MAXSITES.
+#define M61_MAXSITES (1 << 16)
 
-    // track stats
-    global_stats.nactive++;
-    global_stats.ntotal++;
-    global_stats.active_size += sz;
-    global_stats.total_size += sz;
+typedef struct m61_site
+{
+    const char *file;
+    int line;
+} m61_site;
 
-    // min points to the beginning of the allocated data
-    // max points to the end.
-    char *heap_min = (char *)ptr;
-    char *heap_max = (char *)ptr + sz + sizeof(struct m61_metadata);
+static m61_site m61_sites[M61_MAXSITES] = {{"?", 0}};
+static unsigned m61_nsites = 1;
+static unsigned m61_site_index[2 * M61_MAXSITES]; // site id, 0 if empty
+static pthread_mutex_t sites_lock = PTHREAD_MUTEX_INITIALIZER;
 
-    // update heap_min if there is only a new minimum
-    // update heap_max if there is only a new max
-    if (!global_stats.heap_min || global_stats.heap_min >= heap_min)
+// look for file:line in the site index; return its id, or 0 and the empty
+// slot where it belongs
+static unsigned find_site(const char *file, int line, size_t *slot)
+{
+    size_t i = hash_site(file, line) & (2 * M61_MAXSITES - 1);
+    unsigned id;
+    while ((id = __atomic_load_n(&m61_site_index[i], __ATOMIC_ACQUIRE)) != 0)
     {
-        global_stats.heap_min = heap_min;
+        if (m61_sites[id].file == file && m61_sites[id].line == line)
+        {
+            return id;
+        }
+        i = (i + 1) & (2 * M61_MAXSITES - 1);
     }
-    if (!global_stats.heap_max || global_stats.heap_max <= heap_max)
+    *slot = i;
+    return 0;
+}
+
+// return the id of file:line, adding it to the table if it is new
+// lookups take no lock; only adding a site takes the global sites_lock
+static unsigned intern_site(const char *file, int line)
+{
+    size_t slot;
+    unsigned id = find_site(file, line, &slot);
+    if (id)
     {
-        global_stats.heap_max = heap_max;
+        return id;
     }
-
-    // if head exists set the next element in ptr to head
-    if (head)
+    pthread_mutex_lock(&sites_lock);
+    // another thread may have added it since we looked
+    id = find_site(file, line, &slot);
+    if (!id && m61_nsites < M61_MAXSITES)
     {
-        ptr->next = head;
-        head->prev = ptr;
+        id = m61_nsites++;
+        m61_sites[id].file = file;
+        m61_sites[id].line = line;
+        __atomic_store_n(&m61_site_index[slot], id, __ATOMIC_RELEASE);
     }
-    head = ptr;
+    pthread_mutex_unlock(&sites_lock);
+    return id;
+}
+
+// live map
+// two bits per 16-byte granule of the address space: one set when a
+// payload starts there and the block is active, one set once it is freed.
+// m61_free consults it before touching a block's metadata, so invalid and
+// double frees are caught in O(1) without reading memory that may not be
+// mapped. It is a radix tree over 48-bit addresses: livemap_top ->
+// mid-level arrays -> leaves covering 1 MiB each.
+// Nodes are mmapped (zero-filled) on first use and never freed, and bits
+// are flipped atomically, so lookups need no locks.
+#define LIVEMAP_LEAF_SHIFT 20
+#define LIVEMAP_MID_BITS 14
+#define LIVEMAP_TOP_BITS 14
+#define LIVEMAP_GRANULE 16
+#define LIVEMAP_WORDS ((1 << LIVEMAP_LEAF_SHIFT) / LIVEMAP_GRANULE / 32)
+#define LIVEMAP_LIVE_BITS 0x5555555555555555ULL
+
+typedef struct livemap_leaf
+{
+    // two bits per granule, kept in the same word so one cache miss
+    // answers both questions: bit 2k means a payload of an active block
+    // starts at granule k, bit 2k+1 means a freed one did
+    uint64_t bits[LIVEMAP_WORDS];
+} livemap_leaf;
 
-    //  Store buffer at the end of allocated pointer
-    m61_overflow_buffer *buffer_ptr = (m61_overflow_buffer *)((char *)(ptr + 1) + sz);
-    *buffer_ptr = buffer;
+static livemap_leaf **livemap_top[1 << LIVEMAP_TOP_BITS];
 
-    // add to heavy hitter list
-    if (rand() > 0.7)
+// mmap a zero-filled node of `sz` bytes
+static void *livemap_node(size_t sz)
+{
+    void *node = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (node == MAP_FAILED)
     {
-        update_HHList(file, line, sz);
+        abort();
     }
-    //  magic
-    //  increment by the size of the pointer value in this case char?
-    return ptr + 1;
+    return node;
 }
 
-void m61_free(void *ptr, const char *file, int line)
+// return the leaf covering `p`, creating it if `create`; NULL if none
+static livemap_leaf *livemap_leaf_for(uintptr_t p, int create)
 {
-    (void)file, (void)line; // avoid uninitialized variable warnings
-    if (!ptr)
+    if (p >> (LIVEMAP_TOP_BITS + LIVEMAP_MID_BITS + LIVEMAP_LEAF_SHIFT))
     {
-        return;
+        return NULL;
     }
-    // if the heap > ptr force an abort
-    if ((void *)global_stats.heap_min > ptr || (void *)global_stats.heap_max < ptr)
+    livemap_leaf ***top = &livemap_top[p >> (LIVEMAP_MID_BITS + LIVEMAP_LEAF_SHIFT)];
+    livemap_leaf **mid = __atomic_load_n(top, __ATOMIC_ACQUIRE);
+    if (!mid)
     {
-        printf("MEMORY BUG: %s:%d: invalid free of pointer %p, not in heap\n", file, line, ptr);
-        abort();
+        if (!create)
+        {
+            return NULL;
+        }
+        size_t sz = sizeof(livemap_leaf *) << LIVEMAP_MID_BITS;
+        livemap_leaf **node = livemap_node(sz);
+        if (!__atomic_compare_exchange_n(top, &mid, node, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            munmap(node, sz); // another thread installed one first
+        }
+        else
+        {
+            mid = node;
+        }
     }
-
-    // grab the remaining space set to new pointer
-    void *temp_ptr = (char *)ptr - sizeof(struct m61_metadata);
-    struct m61_metadata *metadata_ptr = (struct m61_metadata *)temp_ptr;
-
-    // node not freed but also does not equal the current pointer address
-    if (metadata_ptr->active_flag != 1111)
+    livemap_leaf **slot = &mid[(p >> LIVEMAP_LEAF_SHIFT) & ((1 << LIVEMAP_MID_BITS) - 1)];
+    livemap_leaf *leaf = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (!leaf && create)
     {
-        if (metadata_ptr->ptr_addr != (char *)ptr)
+        livemap_leaf *node = livemap_node(sizeof(livemap_leaf));
+        if (!__atomic_compare_exchange_n(slot, &leaf, node, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
         {
-            printf("MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated\n", file, line, ptr);
-            abort();
+            munmap(node, sizeof(livemap_leaf));
+        }
+        else
+        {
+            leaf = node;
         }
     }
+    return leaf;
+}
 
-    // test 28
-    // check for overflow
-    m61_overflow_buffer *buffer_ptr = (m61_overflow_buffer *)((char *)ptr + metadata_ptr->size);
-    if (buffer_ptr->buffer != 1111)
-    {
+// word index and live bit of `p` within its leaf (the freed bit is the
+// next bit up)
+#define LIVEMAP_WORD(p) (((p) & ((1 << LIVEMAP_LEAF_SHIFT) - 1)) / LIVEMAP_GRANULE / 32)
+#define LIVEMAP_BIT(p) (1ULL << (2 * (((p) / LIVEMAP_GRANULE) % 32)))
 
-        printf("MEMORY BUG: %s:%d: detected wild write during free of pointer %p\n", file, line, ptr);
-        abort();
+// mark `payload` as an active block
+static void livemap_set(char *payload)
+{
+    uintptr_t p = (uintptr_t)payload;
+    livemap_leaf *leaf = livemap_leaf_for(p, 1);
+    uint64_t *word = &leaf->bits[LIVEMAP_WORD(p)];
+    uint64_t bit = LIVEMAP_BIT(p);
+    uint64_t old = __atomic_load_n(word, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(word, &old, (old & ~(bit << 1)) | bit, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
     }
+}
 
-    // Remove node from double linked list
-    if (metadata_ptr->prev)
-        metadata_ptr->prev->next = metadata_ptr->next;
-    else
-        head = metadata_ptr->next;
-    if (metadata_ptr->next)
-        metadata_ptr->next->prev = metadata_ptr->prev;
-
-    // if the freed pointer which was assigned a random int exists, print ERROR message
-    // if pointer is not freed, free the pointer and assign it a random int (in our case 1111) so we know it has been freed and update global stats accordingly
-    if (metadata_ptr && metadata_ptr->active_flag == 1111)
+// mark `payload` as freed; return 1 if it was active (only one of several
+// racing frees of the same block sees 1)
+static int livemap_clear(char *payload)
+{
+    uintptr_t p = (uintptr_t)payload;
+    livemap_leaf *leaf = livemap_leaf_for(p, 0);
+    if (!leaf || p % LIVEMAP_GRANULE != 0)
     {
-        printf("MEMORY BUG: %s%d: invalid free of pointer %p\n", file, line, ptr);
+        return 0;
     }
-    else
+    uint64_t *word = &leaf->bits[LIVEMAP_WORD(p)];
+    uint64_t bit = LIVEMAP_BIT(p);
+    uint64_t old = __atomic_load_n(word, __ATOMIC_RELAXED);
+    do
     {
-        global_stats.nactive--;
-        global_stats.active_size -= metadata_ptr->size;
-        // add flag to indicate node has been freed
-        metadata_ptr->active_flag = 1111;
-        free(temp_ptr);
-    }
+        if (!(old & bit))
+        {
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(word, &old, (old & ~bit) | (bit << 1), 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return 1;
 }
 
-/// m61_realloc(ptr, sz, file, line)
-///    Reallocate the dynamic memory pointed to by `ptr` to hold at least
-///    `sz` bytes, returning a pointer to the new block. If `ptr` is NULL,
-///    behaves like `m61_malloc(sz, file, line)`. If `sz` is 0, behaves
-///    like `m61_free(ptr, file, line)`. The allocation request was at
-///    location `file`:`line`.
+// what the live map knows about a pointer passed to free
+#define LIVEMAP_NONE 0  // not the start of any block
+#define LIVEMAP_LIVE 1  // start of an active block
+#define LIVEMAP_FREED 2 // start of a block that was freed
 
-void *m61_realloc(void *ptr, size_t sz, const char *file, int line)
+static int livemap_state(void *ptr)
 {
-    void *new_ptr = NULL;
-    if (sz)
+    uintptr_t p = (uintptr_t)ptr;
+    livemap_leaf *leaf = livemap_leaf_for(p, 0);
+    if (!leaf || p % LIVEMAP_GRANULE != 0)
     {
-        new_ptr = m61_malloc(sz, file, line);
+        return LIVEMAP_NONE;
     }
-    if (ptr && new_ptr)
+    uint64_t word = __atomic_load_n(&leaf->bits[LIVEMAP_WORD(p)], __ATOMIC_RELAXED);
+    if (word & LIVEMAP_BIT(p))
     {
-        // Copy the data from `ptr` into `new_ptr`.
-        // To do that, we must figure out the size of allocation `ptr`.
-        struct m61_metadata *metadata = (struct m61_metadata *)ptr - 1;
-        size_t old_sz = metadata->size;
-        if (old_sz <= sz)
-            memcpy(new_ptr, ptr, old_sz);
-        else
-            memcpy(new_ptr, ptr, sz);
+        return LIVEMAP_LIVE;
     }
-    m61_free(ptr, file, line);
-    return new_ptr;
+    if (word & (LIVEMAP_BIT(p) << 1))
+    {
+        return LIVEMAP_FREED;
+    }
+    return LIVEMAP_NONE;
 }
 
-/// m61_calloc(nmemb, sz, file, line)
-///    Return a pointer to newly-allocated dynamic memory big enough to
-///    hold an array of `nmemb` elements of `sz` bytes each. The memory
-///    is initialized to zero. If `sz == 0`, then m61_malloc may
-///    either return NULL or a unique, newly-allocated pointer value.
-///    The allocation request was at location `file`:`line`.
-
-void *m61_calloc(size_t nmemb, size_t sz, const char *file, int line)
+// return the highest active payload start <= `p` and >= `lo`, or NULL.
+// Only used to explain invalid frees, so it need not be fast.
+static char *livemap_find_before(uintptr_t p, uintptr_t lo)
 {
-    // Your code here (to fix test016).
-    // maximum number of a possible unsigned int
-    unsigned int maximum_int = -1;
-    // if nmemb * sz > maximum_int force a fail
-    // because nmemb * sz is an int that means if that multiplication
-    // happens to be bigger than an int then it will overflow and the result will wrap around 0.
-    if (nmemb > maximum_int / sz || sz > maximum_int / nmemb)
+    const uintptr_t leaf_size = (uintptr_t)1 << LIVEMAP_LEAF_SHIFT;
+    const uintptr_t mid_size = leaf_size << LIVEMAP_MID_BITS;
+    p &= ~(uintptr_t)(LIVEMAP_GRANULE - 1);
+    while (p >= lo)
     {
-        global_stats.nfail++;
-        return NULL;
+        uintptr_t base;
+        livemap_leaf *leaf = livemap_leaf_for(p, 0);
+        if (leaf)
+        {
+            base = p & ~(leaf_size - 1);
+            size_t w = LIVEMAP_WORD(p);
+            uint64_t bits = __atomic_load_n(&leaf->bits[w], __ATOMIC_RELAXED) & LIVEMAP_LIVE_BITS & (LIVEMAP_BIT(p) | (LIVEMAP_BIT(p) - 1));
+            while (!bits && w > 0)
+            {
+                bits = __atomic_load_n(&leaf->bits[--w], __ATOMIC_RELAXED) & LIVEMAP_LIVE_BITS;
+            }
+            if (bits)
+            {
+                uintptr_t q = base + (w * 32 + (63 - __builtin_clzll(bits)) / 2) * LIVEMAP_GRANULE;
+                return q >= lo ? (char *)q : NULL;
+            }
+        }
+        else if (p >> (LIVEMAP_TOP_BITS + LIVEMAP_MID_BITS + LIVEMAP_LEAF_SHIFT) == 0 &&
+                 !livemap_top[p >> (LIVEMAP_MID_BITS + LIVEMAP_LEAF_SHIFT)])
+        {
+            // skip a whole empty mid-level range
+            base = p & ~(mid_size - 1);
+        }
+        else
+        {
+            base = p & ~(leaf_size - 1);
+        }
+        if (base == 0)
+        {
+            break;
+        }
+        p = base - LIVEMAP_GRANULE;
     }
-    void *ptr = m61_malloc(nmemb * sz, file, line);
-    if (ptr)
+    return NULL;
+}
+
+// call `fn` on every active payload, in address order
+static void livemap_foreach(void (*fn)(char *payload, void *arg), void *arg)
+{
+    for (uintptr_t t = 0; t < (1 << LIVEMAP_TOP_BITS); ++t)
     {
-        memset(ptr, 0, nmemb * sz);
+        livemap_leaf **mid = __atomic_load_n(&livemap_top[t], __ATOMIC_ACQUIRE);
+        for (uintptr_t m = 0; mid && m < (1 << LIVEMAP_MID_BITS); ++m)
+        {
+            livemap_leaf *leaf = __atomic_load_n(&mid[m], __ATOMIC_ACQUIRE);
+            for (uintptr_t w = 0; leaf && w < LIVEMAP_WORDS; ++w)
+            {
+                uint64_t bits = __atomic_load_n(&leaf->bits[w], __ATOMIC_RELAXED) & LIVEMAP_LIVE_BITS;
+                while (bits)
+                {
+                    uintptr_t b = __builtin_ctzll(bits) / 2;
+                    bits &= bits - 1;
+                    fn((char *)((((t << LIVEMAP_MID_BITS) | m) << LIVEMAP_LEAF_SHIFT) + (w * 32 + b) * LIVEMAP_GRANULE), arg);
+                }
+            }
+        }
     }
-    return ptr;
 }
 
-/// m61_getstatistics(stats)
-///    Store the current memory statistics in `*stats`.
+#if M61_COMPACT
+// the state word of an active block whose payload is at `payload`; tying
+// it to the address means a stray pointer almost never passes for a block
+static uint64_t state_tag(char *payload)
+{
+    return ((((uintptr_t)payload ^ 0x6d36315f73746174ULL) * 0x9E3779B97F4A7C15ULL) >> 32) & ~31ULL;
+}
+#else
+// return the active-list stripe for a block
+static m61_active_stripe *active_stripe(struct m61_metadata *metadata)
+{
+    uint64_t h = ((uintptr_t)metadata >> 4) * 0x9E3779B97F4A7C15ULL;
+    return &active_stripes[h >> 58];
+}
+#endif
 
-void m61_getstatistics(struct m61_statistics *stats)
+// fill in the metadata of a new block allocated at file:line, with room
+// for `slack` more bytes
+static void init_metadata(struct m61_metadata *metadata, size_t sz, size_t slack, const char *file, int line)
 {
-    // clean stats
-    // set global stats as stats
-    memset(stats, 0, sizeof(struct m61_statistics));
-    *stats = global_stats;
+#if M61_COMPACT
+    metadata->size = sz;
+    metadata->site = intern_site(file, line);
+    metadata->slack = slack;
+    metadata->state = state_tag((char *)(metadata + 1));
+#else
+    struct m61_metadata m = {sz, 0, 0, (char *)(metadata + 1), file, line, 0, 0, 0, 0, NULL, NULL, slack};
+    *metadata = m;
+#endif
 }
 
-/// m61_printstatistics()
-///    Print the current memory statistics.
+// was padding put in front of the metadata to align the payload?
+static int metadata_aligned(struct m61_metadata *metadata)
+{
+#if M61_COMPACT
+    return (metadata->state & 8) != 0;
+#else
+    return metadata->aligned;
+#endif
+}
 
-void m61_printstatistics(void)
+static void set_metadata_aligned(struct m61_metadata *metadata)
 {
-    struct m61_statistics stats;
-    m61_getstatistics(&stats);
+#if M61_COMPACT
+    metadata->state |= 8;
+#else
+    metadata->aligned = 1;
+#endif
+}
 
-    printf("malloc count: active %10llu   total %10llu   fail %10llu\n",
-           stats.nactive, stats.ntotal, stats.nfail);
-    printf("malloc size:  active %10llu   total %10llu   fail %10llu\n",
-           stats.active_size, stats.total_size, stats.fail_size);
+// was the block mapped on its own by mapped_alloc?
+static int metadata_mapped(struct m61_metadata *metadata)
+{
+#if M61_COMPACT
+    return (metadata->state & 16) != 0;
+#else
+    return metadata->mapped;
+#endif
 }
 
-/// m61_printleakreport()
-///    Print a report of all currently-active allocated blocks of dynamic
-///    memory.
+static void set_metadata_mapped(struct m61_metadata *metadata)
+{
+#if M61_COMPACT
+    metadata->state |= 16;
+#else
+    metadata->mapped = 1;
+#endif
+}
 
-void m61_printleakreport(void)
+// start of the block holding `metadata`. The padding in front of an
+// aligned block's metadata is at least 16 bytes, and its last 8 bytes
+// hold the block's start.
+static char *block_base(struct m61_metadata *metadata)
+{
+    return metadata_aligned(metadata) ? ((char **)metadata)[-1] : (char *)metadata;
+}
+
+// size of a whole block: alignment padding, metadata, payload and slack,
+// overflow buffer
+static size_t block_total(struct m61_metadata *metadata)
+{
+    return ((char *)metadata - block_base(metadata)) + sizeof(struct m61_metadata) + metadata->size + metadata->slack + sizeof(m61_overflow_buffer);
+}
+
+// file and line where a block was allocated
+static const char *metadata_file(struct m61_metadata *metadata)
+{
+#if M61_COMPACT
+    return m61_sites[metadata->site].file;
+#else
+    return metadata->file;
+#endif
+}
+
+static int metadata_line(struct m61_metadata *metadata)
+{
+#if M61_COMPACT
+    return m61_sites[metadata->site].line;
+#else
+    return metadata->line;
+#endif
+}
+
+// the interned site id of a block's file:line
+static unsigned metadata_site(struct m61_metadata *metadata)
+{
+#if M61_COMPACT
+    return metadata->site;
+#else
+    return intern_site(metadata->file, metadata->line);
+#endif
+}
+
+// is the block's lifetime being sampled?
+static int metadata_sampled(struct m61_metadata *metadata)
+{
+#if M61_COMPACT
+    return (metadata->state & 2) != 0;
+#else
+    return metadata->sampled;
+#endif
+}
+
+static void set_metadata_sampled(struct m61_metadata *metadata)
+{
+#if M61_COMPACT
+    metadata->state |= 2;
+#else
+    metadata->sampled = 1;
+#endif
+}
+
+// is the block served from the guard page pool?
+static int metadata_guarded(struct m61_metadata *metadata)
 {
-    for (struct m61_metadata *metadata = head; metadata != NULL; metadata = metadata->next)
+#if M61_COMPACT
+    return (metadata->state & 4) != 0;
+#else
+    return metadata->guarded;
+#endif
+}
+
+static void set_metadata_guarded(struct m61_metadata *metadata)
+{
+#if M61_COMPACT
+    metadata->state |= 4;
+#else
+    metadata->guarded = 1;
+#endif
+}
+
+// is the metadata of the active block at `ptr` undamaged?
+static int metadata_intact(struct m61_metadata *metadata, void *ptr)
+{
+#if M61_COMPACT
+    return (metadata->state & 0xFFFFFFE1ULL) == state_tag(ptr);
+#else
+    return metadata->active_flag != 1111 && metadata->ptr_addr == (char *)ptr;
+#endif
+}
+
+// start tracking a new block as active
+static void track_active(struct m61_metadata *metadata)
+{
+    if (!M61_CHECKS)
+    {
+        return;
+    }
+    livemap_set((char *)(metadata + 1));
+#if !M61_COMPACT
+    if (!M61_TRACKING)
     {
-        printf("LEAK CHECK: %s:%d: allocated object %p with size %llu\n", metadata->file, metadata->line, metadata->ptr_addr, metadata->size);
+        return;
+    }
+    // push the block onto the front of its stripe's active list
+    m61_active_stripe *stripe = active_stripe(metadata);
+    pthread_mutex_lock(&stripe->lock);
+    if (stripe->head)
+    {
+        metadata->next = stripe->head;
+        stripe->head->prev = metadata;
     }
+    stripe->head = metadata;
+    pthread_mutex_unlock(&stripe->lock);
+#endif
 }
 
-// prints heavy hitter report
-// if total bytes of line > %10 print stats
-void m61_heavyHitterTest()
+// stop tracking a block and mark it freed; return 0 if it was already freed
+// (the check and the change are atomic, so two threads cannot both free
+// the same block)
+static int untrack_active(struct m61_metadata *metadata)
+{
+    if (!M61_CHECKS)
+    {
+        return 1;
+    }
+    if (!livemap_clear((char *)(metadata + 1)))
+    {
+        return 0;
+    }
+#if M61_COMPACT
+    metadata->state |= 1;
+    return 1;
+#else
+    if (!M61_TRACKING)
+    {
+        metadata->active_flag = 1111;
+        return 1;
+    }
+    m61_active_stripe *stripe = active_stripe(metadata);
+    pthread_mutex_lock(&stripe->lock);
+    // Remove node from double linked list
+    if (metadata->prev)
+        metadata->prev->next = metadata->next;
+    else
+        stripe->head = metadata->next;
+    if (metadata->next)
+        metadata->next->prev = metadata->prev;
+    // add flag to indicate node has been freed
+    metadata->active_flag = 1111;
+    pthread_mutex_unlock(&stripe->lock);
+    return 1;
+#endif
+}
+
+// batches are processed this many blocks at a time
+#define M61_BATCH_CHUNK 256
+
+// start tracking `n` new blocks as active, taking each stripe's lock once
+static void track_active_batch(struct m61_metadata **blocks, size_t n)
 {
-    // get the first node in heavy hitter linked list
-    m61_heavyhitter_node *ptr = HH_Head;
-    // iterate over list
-    while (ptr != NULL)
+    if (!M61_CHECKS)
+    {
+        return;
+    }
+    for (size_t i = 0; i < n; ++i)
     {
-        // if allocated bytes of file-line is greater than 10% of total bytes being used
-        if ((float)ptr->size / (float)HH_total_bytes > .10)
+        livemap_set((char *)(blocks[i] + 1));
+    }
+#if !M61_COMPACT
+    if (!M61_TRACKING)
+    {
+        return;
+    }
+    // chain the blocks of each stripe together, then splice each chain in
+    struct m61_metadata *heads[M61_STRIPES] = {NULL};
+    struct m61_metadata *tails[M61_STRIPES];
+    for (size_t i = 0; i < n; ++i)
+    {
+        struct m61_metadata *metadata = blocks[i];
+        size_t s = active_stripe(metadata) - active_stripes;
+        metadata->next = heads[s];
+        if (heads[s])
+            heads[s]->prev = metadata;
+        else
+            tails[s] = metadata;
+        heads[s] = metadata;
+    }
+    for (size_t s = 0; s < M61_STRIPES; ++s)
+    {
+        if (heads[s])
         {
-            printf("HEAVY HITTER: %s:%i: %llu bytes, (~%.1f)\n",
-                   ptr->fileName, ptr->lineNumber, ptr->size,
-                   (float)ptr->size / (float)HH_total_bytes * 100);
+            m61_active_stripe *stripe = &active_stripes[s];
+            pthread_mutex_lock(&stripe->lock);
+            tails[s]->next = stripe->head;
+            if (stripe->head)
+                stripe->head->prev = tails[s];
+            stripe->head = heads[s];
+            pthread_mutex_unlock(&stripe->lock);
         }
-        // go to the next one on the list until it reaches the end (NULL)
-        ptr = ptr->next;
     }
-}
\ No newline at end of file
+#endif
+}
+
+// stop tracking up to M61_BATCH_CHUNK blocks, already cleared from the
+// live map, and mark them freed, taking each stripe's lock once
+static void untrack_active_batch(struct m61_metadata **blocks, size_t n)
+{
+#if M61_COMPACT
+    for (size_t i = 0; M61_CHECKS && i < n; ++i)
+    {
+        blocks[i]->state |= 1;
+    }
+#else
+    if (!M61_TRACKING)
+    {
+        for (size_t i = 0; M61_CHECKS && i < n; ++i)
+        {
+            blocks[i]->active_flag = 1111;
+        }
+        return;
+    }
+    // counting sort the blocks by stripe
+    size_t start[M61_STRIPES + 1] = {0};
+    unsigned char stripe_of[M61_BATCH_CHUNK];
+    struct m61_metadata *sorted[M61_BATCH_CHUNK];
+    for (size_t i = 0; i < n; ++i)
+    {
+        stripe_of[i] = active_stripe(blocks[i]) - active_stripes;
+        ++start[stripe_of[i] + 1];
+    }
+    for (size_t s = 0; s < M61_STRIPES; ++s)
+    {
+        start[s + 1] += start[s];
+    }
+    size_t next[M61_STRIPES];
+    memcpy(next, start, sizeof(next));
+    for (size_t i = 0; i < n; ++i)
+    {
+        sorted[next[stripe_of[i]]++] = blocks[i];
+    }
+    for (size_t s = 0; s < M61_STRIPES; ++s)
+    {
+        if (start[s] == start[s + 1])
+        {
+            continue;
+        }
+        m61_active_stripe *stripe = &active_stripes[s];
+        pthread_mutex_lock(&stripe->lock);
+        for (size_t i = start[s]; i < start[s + 1]; ++i)
+        {
+            struct m61_metadata *metadata = sorted[i];
+            if (metadata->prev)
+                metadata->prev->next = metadata->next;
+            else
+                stripe->head = metadata->next;
+            if (metadata->next)
+                metadata->next->prev = metadata->prev;
+            metadata->active_flag = 1111;
+        }
+        pthread_mutex_unlock(&stripe->lock);
+    }
+#endif
+}
+
+// backing allocators
+// every block (metadata + payload + overflow buffer) comes from
+// backend_alloc. By default that is base_malloc. Building with M61_SLAB=1
+// (`make SLAB=1`) serves small blocks from a segregated-fit slab allocator:
+// blocks are rounded up to one of SLAB_NCLASSES size classes (multiples of
+// 16 up to 128, then four classes per power of two, each about 1.25x the
+// last) and carved from page-sized slabs. Each class keeps a FIFO free list,
+// so a freed block is reused as late as possible and its metadata stays
+// intact for double-free checks in the meantime.
+#ifndef M61_SLAB
+#define M61_SLAB 0
+#endif
+
+#define SLAB_PAGESIZE 4096
+#define SLAB_NCLASSES 20
+#define SLAB_MAXSIZE 1024
+
+static const size_t slab_class_size[SLAB_NCLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256, 320, 384, 448, 512, 640, 768, 896, 1024};
+
+// a free slab block; the link lives after the metadata so the metadata
+// (and its freed flag) survives while the block waits on the free list
+typedef struct slab_free_block
+{
+    struct slab_free_block *next;
+} slab_free_block;
+
+typedef struct slab_class
+{
+    pthread_mutex_t lock;
+    char *free_head; // oldest freed block (a block, not its link)
+    char *free_tail; // newest freed block
+} __attribute__((aligned(64))) slab_class;
+
+static slab_class slab_classes[SLAB_NCLASSES] = {
+    [0 ... SLAB_NCLASSES - 1] = {PTHREAD_MUTEX_INITIALIZER, NULL, NULL}};
+
+// return the size class index for a block of `total` bytes (<= SLAB_MAXSIZE)
+static int slab_class_index(size_t total)
+{
+    if (total <= 128)
+    {
+        return total ? (total + 15) / 16 - 1 : 0;
+    }
+    // total is in (2^lg, 2^(lg+1)], split into four equal steps
+    int lg = 63 - __builtin_clzll(total - 1);
+    size_t quarter = ((size_t)1 << lg) / 4;
+    return 8 + (lg - 7) * 4 + (total - 1 - ((size_t)1 << lg)) / quarter;
+}
+
+// the free-list link of a slab block
+static slab_free_block *slab_link(char *block)
+{
+    return (slab_free_block *)(block + sizeof(struct m61_metadata));
+}
+
+// pop the `n` oldest free blocks of a class into `blocks`, carving new
+// slabs when the free list runs out; return the number popped. One lock
+// acquisition covers the whole batch, and blocks from a fresh slab are
+// contiguous.
+static size_t slab_alloc_batch(size_t total, void **blocks, size_t n)
+{
+    int c = slab_class_index(total);
+    size_t size = slab_class_size[c];
+    slab_class *sc = &slab_classes[c];
+    size_t i = 0;
+    pthread_mutex_lock(&sc->lock);
+    for (; i < n; ++i)
+    {
+        if (!sc->free_head)
+        {
+            char *slab = base_malloc(SLAB_PAGESIZE);
+            if (!slab)
+            {
+                break;
+            }
+            note_reserved(SLAB_PAGESIZE);
+            for (size_t off = 0; off + size <= SLAB_PAGESIZE; off += size)
+            {
+                slab_link(slab + off)->next = NULL;
+                if (sc->free_tail)
+                {
+                    slab_link(sc->free_tail)->next = (slab_free_block *)(slab + off);
+                }
+                else
+                {
+                    sc->free_head = slab + off;
+                }
+                sc->free_tail = slab + off;
+            }
+        }
+        blocks[i] = sc->free_head;
+        sc->free_head = (char *)slab_link(sc->free_head)->next;
+        if (!sc->free_head)
+        {
+            sc->free_tail = NULL;
+        }
+    }
+    pthread_mutex_unlock(&sc->lock);
+    return i;
+}
+
+// pop the oldest free block of a class, carving a new slab if there is none
+static void *slab_alloc(size_t total)
+{
+    void *block;
+    return slab_alloc_batch(total, &block, 1) ? block : NULL;
+}
+
+// append a block to the end of its class's free list
+static void slab_free(void *block, size_t total)
+{
+    slab_class *sc = &slab_classes[slab_class_index(total)];
+    slab_link(block)->next = NULL;
+    pthread_mutex_lock(&sc->lock);
+    if (sc->free_tail)
+    {
+        slab_link(sc->free_tail)->next = block;
+    }
+    else
+    {
+        sc->free_head = block;
+    }
+    sc->free_tail = block;
+    pthread_mutex_unlock(&sc->lock);
+}
+
+// append `n` blocks of one class to the end of its free list under a
+// single lock acquisition
+static void slab_free_batch(void **blocks, size_t n, size_t total)
+{
+    if (n == 0)
+    {
+        return;
+    }
+    slab_class *sc = &slab_classes[slab_class_index(total)];
+    for (size_t i = 0; i + 1 < n; ++i)
+    {
+        slab_link(blocks[i])->next = blocks[i + 1];
+    }
+    slab_link(blocks[n - 1])->next = NULL;
+    pthread_mutex_lock(&sc->lock);
+    if (sc->free_tail)
+    {
+        slab_link(sc->free_tail)->next = blocks[0];
+    }
+    else
+    {
+        sc->free_head = blocks[0];
+    }
+    sc->free_tail = blocks[n - 1];
+    pthread_mutex_unlock(&sc->lock);
+}
+
+// allocate a block of at least `*total` bytes from the configured
+// backend, and set `*total` to the number of bytes usable
+static void *backend_alloc(size_t *total)
+{
+    if (M61_SLAB && *total <= SLAB_MAXSIZE)
+    {
+        *total = slab_class_size[slab_class_index(*total)];
+        return slab_alloc(*total);
+    }
+    void *block = base_malloc(*total);
+    if (block)
+    {
+        note_reserved(*total);
+    }
+    return block;
+}
+
+// allocate up to `n` blocks like backend_alloc, storing them in `blocks`;
+// return the number allocated
+static size_t backend_alloc_batch(size_t *total, void **blocks, size_t n)
+{
+    if (M61_SLAB && *total <= SLAB_MAXSIZE)
+    {
+        *total = slab_class_size[slab_class_index(*total)];
+        return slab_alloc_batch(*total, blocks, n);
+    }
+    size_t i = 0;
+    while (i < n && (blocks[i] = base_malloc(*total)))
+    {
+        ++i;
+    }
+    note_reserved(i * *total);
+    return i;
+}
+
+// return a block of `total` bytes to the backend it came from
+static void backend_free(void *block, size_t total)
+{
+    if (M61_SLAB && total <= SLAB_MAXSIZE)
+    {
+        slab_free(block, total);
+    }
+    else
+    {
+        base_free(block);
+        note_reserved(-(long long)total);
+    }
+}
+
+// return `n` blocks of `total` bytes to the backend they came from
+static void backend_free_batch(void **blocks, size_t n, size_t total)
+{
+    if (M61_SLAB && total <= SLAB_MAXSIZE)
+    {
+        slab_free_batch(blocks, n, total);
+        return;
+    }
+    for (size_t i = 0; i < n; ++i)
+    {
+        base_free(blocks[i]);
+    }
+    note_reserved(-(long long)(n * total));
+}
+
+// thread caches
+// blocks of up to SLAB_MAXSIZE bytes are rounded up to a slab size class,
+// and when freed (after leaving the quarantine) they go to a per-thread
+// LIFO free list for their class instead of the backend. Allocations of
+// that class pop from the list first, so a thread that frees about as much
+// as it allocates never touches a shared lock. A list holding more than
+// tcache_max_blocks blocks spills half of them to the backend at once; an
+// empty list refills with TCACHE_REFILL blocks at once from the slab
+// backend (or one block from base_malloc, which has no batch path). Like
+// the quarantine, the cache belongs to the thread's stats shard; it is
+// emptied when its thread exits.
+#define TCACHE_REFILL 32
+
+typedef struct m61_tcache
+{
+    char *head[SLAB_NCLASSES];     // most recently cached block
+    unsigned count[SLAB_NCLASSES]; // # blocks cached
+} m61_tcache;
+
+static size_t tcache_max_blocks = 64;
+
+// the tcache size class of a block of `total` bytes, or -1 if blocks that
+// size are not cached
+static int tcache_class(size_t total)
+{
+    if (total > SLAB_MAXSIZE || __atomic_load_n(&tcache_max_blocks, __ATOMIC_RELAXED) == 0)
+    {
+        return -1;
+    }
+    return slab_class_index(total);
+}
+
+// pop up to `n` blocks of class `c` from `tc` into `blocks`
+static size_t tcache_pop(m61_tcache *tc, int c, void **blocks, size_t n)
+{
+    size_t i = 0;
+    for (; i < n && tc->head[c]; ++i)
+    {
+        blocks[i] = tc->head[c];
+        tc->head[c] = (char *)slab_link(tc->head[c])->next;
+        --tc->count[c];
+    }
+    return i;
+}
+
+// give the oldest `n` blocks of class `c` back to the backend. The list
+// is newest first, so walk past the blocks being kept.
+static void tcache_spill(m61_tcache *tc, int c, size_t n)
+{
+    void *blocks[M61_BATCH_CHUNK];
+    size_t keep = tc->count[c] - n;
+    char **link = &tc->head[c];
+    for (size_t i = 0; i < keep; ++i)
+    {
+        link = (char **)&slab_link(*link)->next;
+    }
+    char *block = *link;
+    *link = NULL;
+    tc->count[c] = keep;
+    while (block)
+    {
+        size_t i = 0;
+        for (; i < M61_BATCH_CHUNK && block; ++i)
+        {
+            blocks[i] = block;
+            block = (char *)slab_link(block)->next;
+        }
+        backend_free_batch(blocks, i, slab_class_size[c]);
+    }
+}
+
+// give every cached block of a shard back to the backend
+static void tcache_flush(m61_stats_shard *shard)
+{
+    m61_tcache *tc = shard->tcache;
+    for (int c = 0; tc && c < SLAB_NCLASSES; ++c)
+    {
+        tcache_spill(tc, c, tc->count[c]);
+    }
+}
+
+// allocate a block like backend_alloc, from this thread's cache if it can
+static void *cache_alloc(size_t *total)
+{
+    int c = tcache_class(*total);
+    if (c < 0)
+    {
+        return backend_alloc(total);
+    }
+    *total = slab_class_size[c];
+    m61_tcache *tc = m61_shard()->tcache;
+    void *block;
+    if (tc && tcache_pop(tc, c, &block, 1))
+    {
+        return block;
+    }
+    if (!tc || !M61_SLAB)
+    {
+        return backend_alloc(total);
+    }
+    // take a batch from the slab class: one for now, the rest for later
+    void *blocks[TCACHE_REFILL];
+    size_t n = backend_alloc_batch(total, blocks, TCACHE_REFILL);
+    for (size_t i = 1; i < n; ++i)
+    {
+        slab_link(blocks[i])->next = (slab_free_block *)tc->head[c];
+        tc->head[c] = blocks[i];
+        ++tc->count[c];
+    }
+    return n ? blocks[0] : NULL;
+}
+
+// free a block like backend_free, into this thread's cache if it can
+static void cache_free(void *block, size_t total)
+{
+    int c = tcache_class(total);
+    // blocks allocated while the cache was off may not be class-sized
+    if (c < 0 || slab_class_size[c] != total)
+    {
+        backend_free(block, total);
+        return;
+    }
+    m61_stats_shard *shard = m61_shard();
+    m61_tcache *tc = shard->tcache;
+    if (!tc)
+    {
+        tc = shard->tcache = base_malloc(sizeof(m61_tcache));
+        if (!tc)
+        {
+            backend_free(block, total);
+            return;
+        }
+        memset(tc, 0, sizeof(m61_tcache));
+    }
+    slab_link(block)->next = (slab_free_block *)tc->head[c];
+    tc->head[c] = block;
+    ++tc->count[c];
+    size_t max_blocks = __atomic_load_n(&tcache_max_blocks, __ATOMIC_RELAXED);
+    if (tc->count[c] > max_blocks)
+    {
+        tcache_spill(tc, c, tc->count[c] - max_blocks / 2);
+    }
+}
+
+/// m61_set_tcache(max_blocks)
+///    Cache up to `max_blocks` freed blocks per size class per thread. 0
+///    turns the caches off.
+
+void m61_set_tcache(size_t max_blocks)
+{
+    __atomic_store_n(&tcache_max_blocks, max_blocks, __ATOMIC_RELAXED);
+    m61_tcache *tc = my_shard ? my_shard->tcache : NULL;
+    for (int c = 0; tc && c < SLAB_NCLASSES; ++c)
+    {
+        if (tc->count[c] > max_blocks)
+        {
+            tcache_spill(tc, c, tc->count[c] - max_blocks);
+        }
+    }
+}
+
+// read the cache limit from M61_TCACHE_BLOCKS
+__attribute__((constructor)) static void m61_tcache_init(void)
+{
+    const char *blocks = getenv("M61_TCACHE_BLOCKS");
+    if (blocks && *blocks)
+    {
+        m61_set_tcache(strtoull(blocks, NULL, 0));
+    }
+}
+
+// quarantine
+// freed blocks are not handed back to the backend right away. m61_free
+// poisons the payload and appends the block to a per-thread FIFO ring;
+// once the ring holds more than quarantine_max_blocks blocks or
+// quarantine_max_bytes bytes, the oldest block is evicted, its poison is
+// checked (any change means something wrote through a dangling pointer),
+// and only then is it freed. The ring belongs to the thread's stats
+// shard, so it needs no locks and outlives its thread with the shard.
+#define QUARANTINE_CAPACITY 4096 // most blocks a ring can hold
+#define QUARANTINE_POISON 0xFD
+#define QUARANTINE_POISON_MAX 4096 // poison at most this many payload bytes
+
+typedef struct m61_quarantine_entry
+{
+    char *block;                   // start of the block
+    size_t total;                  // whole block (see block_total)
+    struct m61_metadata *metadata; // the block's metadata
+} m61_quarantine_entry;
+
+typedef struct m61_quarantine
+{
+    m61_quarantine_entry ring[QUARANTINE_CAPACITY];
+    size_t head;  // index of the oldest entry
+    size_t count; // # blocks held
+    size_t bytes; // # bytes held (whole blocks)
+} m61_quarantine;
+
+static size_t quarantine_max_bytes = 256 << 10;
+static size_t quarantine_max_blocks = 1024;
+
+// number of payload bytes poisoned in a quarantined block
+static size_t quarantine_poison_size(m61_quarantine_entry *e)
+{
+    size_t sz = e->block + e->total - (char *)(e->metadata + 1) - sizeof(m61_overflow_buffer);
+    return sz < QUARANTINE_POISON_MAX ? sz : QUARANTINE_POISON_MAX;
+}
+
+// free the oldest quarantined block after checking its poison
+static void quarantine_evict(m61_quarantine *q)
+{
+    m61_quarantine_entry e = q->ring[q->head];
+    q->head = (q->head + 1) % QUARANTINE_CAPACITY;
+    --q->count;
+    q->bytes -= e.total;
+
+    unsigned char *payload = (unsigned char *)(e.metadata + 1);
+    size_t n = quarantine_poison_size(&e);
+    // compare a word at a time (payloads are 16-byte aligned), then find
+    // the exact byte only if something changed
+    size_t i = 0;
+    while (i + 8 <= n && *(uint64_t *)(payload + i) == 0x0101010101010101ULL * QUARANTINE_POISON)
+    {
+        i += 8;
+    }
+    for (; i < n; ++i)
+    {
+        if (payload[i] != QUARANTINE_POISON)
+        {
+            struct m61_metadata *metadata = e.metadata;
+            fprintf(stderr, "MEMORY BUG: %s:%d: use after free: freed object %p with size %llu was written %zu bytes in\n",
+                    metadata_file(metadata), metadata_line(metadata), payload,
+                    (unsigned long long)metadata->size, i);
+            abort();
+        }
+    }
+    cache_free(e.block, e.total);
+}
+
+// quarantine the freed block `metadata`, or free it if quarantine is off
+static void quarantine_push(m61_stats_shard *shard, struct m61_metadata *metadata)
+{
+    m61_quarantine_entry e = {block_base(metadata), block_total(metadata), metadata};
+    size_t max_blocks = __atomic_load_n(&quarantine_max_blocks, __ATOMIC_RELAXED);
+    size_t max_bytes = __atomic_load_n(&quarantine_max_bytes, __ATOMIC_RELAXED);
+    if (!M61_CHECKS || max_blocks == 0 || e.total > max_bytes)
+    {
+        cache_free(e.block, e.total);
+        return;
+    }
+    m61_quarantine *q = shard->quarantine;
+    if (!q)
+    {
+        q = shard->quarantine = base_malloc(sizeof(m61_quarantine));
+        if (!q)
+        {
+            cache_free(e.block, e.total);
+            return;
+        }
+        q->head = q->count = q->bytes = 0;
+    }
+    memset(metadata + 1, QUARANTINE_POISON, quarantine_poison_size(&e));
+    while (q->count > 0 && (q->count >= max_blocks || q->bytes + e.total > max_bytes))
+    {
+        quarantine_evict(q);
+    }
+    q->ring[(q->head + q->count) % QUARANTINE_CAPACITY] = e;
+    ++q->count;
+    q->bytes += e.total;
+}
+
+/// m61_set_quarantine(max_bytes, max_blocks)
+///    Hold up to `max_blocks` freed blocks totalling at most `max_bytes`
+///    per thread before reusing them. 0 blocks turns quarantine off.
+
+void m61_set_quarantine(size_t max_bytes, size_t max_blocks)
+{
+    if (max_blocks > QUARANTINE_CAPACITY)
+    {
+        max_blocks = QUARANTINE_CAPACITY;
+    }
+    __atomic_store_n(&quarantine_max_bytes, max_bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&quarantine_max_blocks, max_blocks, __ATOMIC_RELAXED);
+}
+
+/// m61_flush_quarantine()
+///    Check and free every block in this thread's quarantine.
+
+void m61_flush_quarantine(void)
+{
+    m61_quarantine *q = m61_shard()->quarantine;
+    while (q && q->count > 0)
+    {
+        quarantine_evict(q);
+    }
+}
+
+// read the quarantine limits from M61_QUARANTINE_BYTES and
+// M61_QUARANTINE_BLOCKS
+__attribute__((constructor)) static void m61_quarantine_init(void)
+{
+    const char *bytes = getenv("M61_QUARANTINE_BYTES");
+    const char *blocks = getenv("M61_QUARANTINE_BLOCKS");
+    m61_set_quarantine(bytes && *bytes ? strtoull(bytes, NULL, 0) : quarantine_max_bytes,
+                       blocks && *blocks ? strtoull(blocks, NULL, 0) : quarantine_max_blocks);
+}
+
+// guard pages
+// with m61_set_guard(min_size), blocks of at least min_size bytes skip the
+// backend. Each gets its own mapping whose last page is PROT_NONE, and its
+// payload ends as close to that guard page as 16-byte alignment allows, so
+// an overrun faults on the spot instead of being found at free time (and
+// only if it hits the overflow buffer). The 0-15 bytes between the payload
+// and the guard page are filled with GUARD_FILL and checked at free. A
+// freed block's pages are made PROT_NONE as well, so a use after free
+// faults too, and its mapping joins a FIFO pool for its size class (a power
+// of 2 number of pages) instead of being unmapped: reusing it costs one
+// mprotect, where a fresh block costs an mmap, an mprotect, a munmap and
+// page faults.
+#define GUARD_NCLASSES 32            // class c holds mappings of 2^c data pages
+#define GUARD_POOL_DEPTH 16          // most pooled mappings per class
+#define GUARD_POOL_BYTES (64 << 20)  // most bytes pooled in all classes
+#define GUARD_FILL 0xAB
+
+typedef struct m61_guard_class
+{
+    char *ring[GUARD_POOL_DEPTH]; // pooled mappings, oldest at `head`
+    size_t head;
+    size_t count;
+} m61_guard_class;
+
+static m61_guard_class guard_pool[GUARD_NCLASSES];
+static size_t guard_pool_bytes = 0;
+static pthread_mutex_t guard_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t guard_min_size = 0; // 0 means guard pages are off
+static size_t page_size = 4096; // the system's, set at startup
+
+// should a block of `sz` bytes get a guard page?
+static int guard_applies(size_t sz)
+{
+    size_t min_size = __atomic_load_n(&guard_min_size, __ATOMIC_RELAXED);
+    return min_size && sz >= min_size;
+}
+
+// the pool class of a guarded block of `sz` bytes: its metadata, payload
+// and alignment padding fit in 2^class pages
+static int guard_class(size_t sz)
+{
+    size_t pages = (sizeof(struct m61_metadata) + sz + 15 + page_size - 1) / page_size;
+    int c = 0;
+    while (((size_t)1 << c) < pages)
+    {
+        ++c;
+    }
+    return c;
+}
+
+// the guard page of the guarded block `metadata`
+static char *guard_page(struct m61_metadata *metadata)
+{
+    uintptr_t end = (uintptr_t)(metadata + 1) + metadata->size;
+    return (char *)((end + page_size - 1) & ~(uintptr_t)(page_size - 1));
+}
+
+// allocate a guarded block for `sz` bytes and return its metadata, which
+// the caller fills in
+static struct m61_metadata *guard_alloc(size_t sz)
+{
+    int c = guard_class(sz);
+    if (c >= GUARD_NCLASSES)
+    {
+        return NULL;
+    }
+    size_t data = ((size_t)1 << c) * page_size;
+    size_t size = data + page_size;
+    char *map = NULL;
+    pthread_mutex_lock(&guard_lock);
+    m61_guard_class *gc = &guard_pool[c];
+    if (gc->count)
+    {
+        map = gc->ring[gc->head];
+        gc->head = (gc->head + 1) % GUARD_POOL_DEPTH;
+        --gc->count;
+        guard_pool_bytes -= size;
+    }
+    pthread_mutex_unlock(&guard_lock);
+
+    if (map && mprotect(map, data, PROT_READ | PROT_WRITE) != 0)
+    {
+        munmap(map, size);
+        note_reserved(-(long long)size);
+        map = NULL;
+    }
+    if (!map)
+    {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED)
+        {
+            return NULL;
+        }
+        if (mprotect(map + data, page_size, PROT_NONE) != 0)
+        {
+            munmap(map, size);
+            return NULL;
+        }
+        note_reserved(size);
+    }
+    char *payload = (char *)((uintptr_t)(map + data - sz) & ~(uintptr_t)15);
+    memset(payload + sz, GUARD_FILL, map + data - payload - sz);
+    return (struct m61_metadata *)payload - 1;
+}
+
+// are the padding bytes between a guarded block and its guard page intact?
+static int guard_fill_intact(struct m61_metadata *metadata)
+{
+    unsigned char *p = (unsigned char *)(metadata + 1) + metadata->size;
+    unsigned char *guard = (unsigned char *)guard_page(metadata);
+    for (; p < guard; ++p)
+    {
+        if (*p != GUARD_FILL)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// protect the pages of a freed guarded block and pool its mapping
+static void guard_free(struct m61_metadata *metadata)
+{
+    int c = guard_class(metadata->size);
+    size_t data = ((size_t)1 << c) * page_size;
+    size_t size = data + page_size;
+    char *map = guard_page(metadata) - data;
+    char *unmap = map;
+    if (mprotect(map, data, PROT_NONE) == 0)
+    {
+        pthread_mutex_lock(&guard_lock);
+        m61_guard_class *gc = &guard_pool[c];
+        if (gc->count == GUARD_POOL_DEPTH)
+        {
+            // replace the oldest mapping of the class
+            unmap = gc->ring[gc->head];
+            gc->ring[gc->head] = map;
+            gc->head = (gc->head + 1) % GUARD_POOL_DEPTH;
+        }
+        else if (guard_pool_bytes + size <= GUARD_POOL_BYTES)
+        {
+            gc->ring[(gc->head + gc->count) % GUARD_POOL_DEPTH] = map;
+            ++gc->count;
+            guard_pool_bytes += size;
+            unmap = NULL;
+        }
+        pthread_mutex_unlock(&guard_lock);
+    }
+    if (unmap)
+    {
+        munmap(unmap, size);
+        note_reserved(-(long long)size);
+    }
+}
+
+/// m61_set_guard(min_size)
+///    Serve blocks of at least `min_size` bytes from guard pages. 0 turns
+///    guard pages off.
+
+void m61_set_guard(size_t min_size)
+{
+    __atomic_store_n(&guard_min_size, min_size, __ATOMIC_RELAXED);
+}
+
+// read the guard page threshold from M61_GUARD
+__attribute__((constructor)) static void m61_guard_init(void)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    if (pagesize > 0)
+    {
+        page_size = pagesize;
+    }
+    const char *min_size = getenv("M61_GUARD");
+    if (min_size && *min_size)
+    {
+        m61_set_guard(strtoull(min_size, NULL, 0));
+    }
+}
+
+// mapped blocks
+// base_malloc never gives memory back to the system, so after a spike of
+// large allocations the process stays big. Blocks of at least
+// mmap_threshold bytes are instead mapped on their own, with the metadata
+// at the start of the mapping, and unmapped when freed (they skip the
+// quarantine, which holds no blocks that large by default).
+#define MMAP_THRESHOLD (256 << 10)
+
+static size_t mmap_threshold = MMAP_THRESHOLD; // 0 means never map
+
+// should a block of `sz` bytes be mapped on its own?
+static int mapped_applies(size_t sz)
+{
+    size_t threshold = __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED);
+    return threshold && sz >= threshold;
+}
+
+// map a block of at least `*total` bytes, and set `*total` to its size
+static void *mapped_alloc(size_t *total)
+{
+    size_t size = (*total + page_size - 1) & ~(page_size - 1);
+    void *block = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED)
+    {
+        return NULL;
+    }
+    note_reserved(size);
+    *total = size;
+    return block;
+}
+
+static void mapped_free(char *block, size_t total)
+{
+    munmap(block, total);
+    note_reserved(-(long long)total);
+}
+
+/// m61_set_mmap_threshold(min_size)
+///    Map blocks of at least `min_size` bytes on their own. 0 turns the
+///    mapped path off.
+
+void m61_set_mmap_threshold(size_t min_size)
+{
+    __atomic_store_n(&mmap_threshold, min_size, __ATOMIC_RELAXED);
+}
+
+// read the threshold from M61_MMAP_THRESHOLD
+__attribute__((constructor)) static void m61_mmap_init(void)
+{
+    const char *min_size = getenv("M61_MMAP_THRESHOLD");
+    if (min_size && *min_size)
+    {
+        m61_set_mmap_threshold(strtoull(min_size, NULL, 0));
+    }
+}
+
+// create the struct in which we will store heavy hitter data
+// heavy hitters are tracked with a weighted Space-Saving sketch: at most
+// HH_k call sites are monitored at once. When a new site arrives and every
+// counter is taken, the site with the fewest bytes is evicted and the new
+// site inherits its byte count as `error`. So for every monitored site
+//     size - error <= true bytes <= size,   error <= HH_total_bytes / HH_k
+// and every site with more than HH_total_bytes / HH_k bytes is monitored.
+typedef struct m61_heavyhitter_node
+{
+    const char *fileName;
+    int lineNumber;
+    unsigned long long HHNum;  // allocations seen since the site was monitored
+    unsigned long long size;   // estimated bytes, never an underestimate
+    unsigned long long error;  // bytes inherited from the evicted site
+    size_t heapPos;            // position in HH_Heap
+} m61_heavyhitter_node;
+
+#define HH_DEFAULT_COUNTERS 1024
+
+// the sketch is allocated once with base_malloc by m61_heavyhitter_init:
+// HH_Counters holds the k counters, HH_Heap is a min-heap of counter indexes
+// ordered by size, and HH_Index is an open-addressing hash table from
+// (file pointer, line) to counter index + 1 (0 means empty)
+m61_heavyhitter_node *HH_Counters = NULL;
+size_t *HH_Heap = NULL;
+unsigned *HH_Index = NULL;
+size_t HH_k = 0;
+size_t HH_count = 0;
+size_t HH_index_capacity = 0;
+
+// a global variable to store the total number of allocated bytes seen
+// by the heavy hitter sketch
+unsigned long long HH_total_bytes = 0;
+
+// hash a call site (file pointer, line) into an index slot
+static size_t hash_HHSite(const char *file, int line)
+{
+    return (size_t)hash_site(file, line) & (HH_index_capacity - 1);
+}
+
+// find the index slot for a call site, or the empty slot where it belongs
+static size_t find_HHSlot(const char *file, int line)
+{
+    size_t i = hash_HHSite(file, line);
+    while (HH_Index[i] != 0)
+    {
+        m61_heavyhitter_node *node = &HH_Counters[HH_Index[i] - 1];
+        if (node->fileName == file && node->lineNumber == line)
+        {
+            break;
+        }
+        i = (i + 1) & (HH_index_capacity - 1);
+    }
+    return i;
+}
+
+// empty index slot `i`, shifting later entries of the probe run back so
+// lookups never stop early (no tombstones needed)
+static void remove_HHSlot(size_t i)
+{
+    size_t mask = HH_index_capacity - 1;
+    size_t j = i;
+    while (1)
+    {
+        j = (j + 1) & mask;
+        if (HH_Index[j] == 0)
+        {
+            break;
+        }
+        m61_heavyhitter_node *node = &HH_Counters[HH_Index[j] - 1];
+        size_t home = hash_HHSite(node->fileName, node->lineNumber);
+        // entry j may move to i only if its home slot is not in (i, j]
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            HH_Index[i] = HH_Index[j];
+            i = j;
+        }
+    }
+    HH_Index[i] = 0;
+}
+
+// swap two heap entries and fix their counters' heap positions
+static void swap_HHHeap(size_t a, size_t b)
+{
+    size_t tmp = HH_Heap[a];
+    HH_Heap[a] = HH_Heap[b];
+    HH_Heap[b] = tmp;
+    HH_Counters[HH_Heap[a]].heapPos = a;
+    HH_Counters[HH_Heap[b]].heapPos = b;
+}
+
+// restore the min-heap after the counter at heap position `pos` grew
+static void siftdown_HHHeap(size_t pos)
+{
+    while (1)
+    {
+        size_t smallest = pos;
+        size_t left = 2 * pos + 1, right = 2 * pos + 2;
+        if (left < HH_count && HH_Counters[HH_Heap[left]].size < HH_Counters[HH_Heap[smallest]].size)
+        {
+            smallest = left;
+        }
+        if (right < HH_count && HH_Counters[HH_Heap[right]].size < HH_Counters[HH_Heap[smallest]].size)
+        {
+            smallest = right;
+        }
+        if (smallest == pos)
+        {
+            return;
+        }
+        swap_HHHeap(pos, smallest);
+        pos = smallest;
+    }
+}
+
+// restore the min-heap after a counter was added at heap position `pos`
+static void siftup_HHHeap(size_t pos)
+{
+    while (pos > 0 && HH_Counters[HH_Heap[(pos - 1) / 2]].size > HH_Counters[HH_Heap[pos]].size)
+    {
+        swap_HHHeap(pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+}
+
+// the sketch is shared by all threads; sampling keeps this lock cold
+static pthread_mutex_t HH_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// (re)allocate the sketch with `k` counters; HH_lock must be held
+static void init_HHSketch(size_t k)
+{
+    if (k == 0)
+    {
+        k = 1;
+    }
+    base_free(HH_Counters);
+    base_free(HH_Heap);
+    base_free(HH_Index);
+
+    // keep the index at most half full so probe runs stay short
+    size_t capacity = 2;
+    while (capacity < 2 * k)
+    {
+        capacity *= 2;
+    }
+    HH_Counters = base_malloc(k * sizeof(m61_heavyhitter_node));
+    HH_Heap = base_malloc(k * sizeof(size_t));
+    HH_Index = base_malloc(capacity * sizeof(unsigned));
+    if (!HH_Counters || !HH_Heap || !HH_Index)
+    {
+        abort();
+    }
+    memset(HH_Index, 0, capacity * sizeof(unsigned));
+    HH_k = k;
+    HH_count = 0;
+    HH_index_capacity = capacity;
+    HH_total_bytes = 0;
+}
+
+/// m61_heavyhitter_init(k)
+///    Reset the heavy hitter sketch so it monitors at most `k` call sites.
+
+void m61_heavyhitter_init(size_t k)
+{
+    // counts still batched belong to the old sketch
+    hh_batch_merge_all();
+    pthread_mutex_lock(&HH_lock);
+    init_HHSketch(k);
+    pthread_mutex_unlock(&HH_lock);
+}
+
+// insert data into the heavy hitter sketch; HH_lock must be held
+// `sz` bytes in `count` allocations were made at file:line
+// if the file:line is already monitored, add the size
+// if not take a free counter, or evict the smallest counter
+static void merge_HHSite(const char *file, int line, unsigned long long sz, unsigned long long count)
+{
+    if (!HH_Counters)
+    {
+        init_HHSketch(HH_DEFAULT_COUNTERS);
+    }
+    HH_total_bytes += sz;
+
+    size_t slot = find_HHSlot(file, line);
+    if (HH_Index[slot] != 0)
+    {
+        // update the fields
+        m61_heavyhitter_node *ptr = &HH_Counters[HH_Index[slot] - 1];
+        ptr->size += sz;
+        ptr->HHNum += count;
+        siftdown_HHHeap(ptr->heapPos);
+        return;
+    }
+
+    if (HH_count < HH_k)
+    {
+        // a counter is still free
+        size_t c = HH_count++;
+        m61_heavyhitter_node *ptr = &HH_Counters[c];
+        ptr->fileName = file;
+        ptr->lineNumber = line;
+        ptr->HHNum = count;
+        ptr->size = sz;
+        ptr->error = 0;
+        ptr->heapPos = c;
+        HH_Heap[c] = c;
+        HH_Index[slot] = c + 1;
+        siftup_HHHeap(c);
+        return;
+    }
+
+    // evict the site with the fewest bytes; the new site inherits its count
+    size_t c = HH_Heap[0];
+    m61_heavyhitter_node *ptr = &HH_Counters[c];
+    remove_HHSlot(find_HHSlot(ptr->fileName, ptr->lineNumber));
+    ptr->fileName = file;
+    ptr->lineNumber = line;
+    ptr->HHNum = count;
+    ptr->error = ptr->size;
+    ptr->size += sz;
+    HH_Index[find_HHSlot(file, line)] = c + 1;
+    siftdown_HHHeap(0);
+}
+
+// insert data into the heavy hitter sketch right away
+void update_HHList(const char *file, int line, unsigned long long sz, unsigned long long count)
+{
+    pthread_mutex_lock(&HH_lock);
+    merge_HHSite(file, line, sz, count);
+    pthread_mutex_unlock(&HH_lock);
+}
+
+// per-thread heavy hitter batches
+// taking HH_lock on every allocation would make it a lock every thread
+// meets, so each thread sums its allocations per site in a small
+// direct-mapped table in its stats shard, guarded by a lock of its own
+// that only readers contend for. A table is merged into the sketch under
+// one HH_lock acquisition when a site finds its slot taken by another,
+// every HH_BATCH_EVENTS allocations, when its thread exits, and whenever
+// the sketch is read. Summed updates are still weighted Space-Saving
+// updates, so the sketch's error bounds hold.
+#define HH_BATCH_SLOTS 64
+#define HH_BATCH_EVENTS 256
+
+typedef struct m61_hh_batch_slot
+{
+    const char *file;
+    int line;
+    unsigned long long size;
+    unsigned long long count; // 0 if the slot is empty
+} m61_hh_batch_slot;
+
+typedef struct m61_hh_batch
+{
+    m61_hh_batch_slot slots[HH_BATCH_SLOTS];
+    unsigned nevents; // updates since the last merge
+} m61_hh_batch;
+
+// merge a batch into the sketch and empty it; its shard's hh_lock must be
+// held
+static void merge_HHBatch(m61_hh_batch *batch)
+{
+    if (!batch || batch->nevents == 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&HH_lock);
+    for (int i = 0; i < HH_BATCH_SLOTS; ++i)
+    {
+        m61_hh_batch_slot *slot = &batch->slots[i];
+        if (slot->count)
+        {
+            merge_HHSite(slot->file, slot->line, slot->size, slot->count);
+            slot->size = slot->count = 0;
+        }
+    }
+    pthread_mutex_unlock(&HH_lock);
+    batch->nevents = 0;
+}
+
+// merge one shard's batched counts into the sketch
+static void hh_batch_merge(m61_stats_shard *shard)
+{
+    pthread_mutex_lock(&shard->hh_lock);
+    merge_HHBatch(shard->hh);
+    pthread_mutex_unlock(&shard->hh_lock);
+}
+
+// merge every thread's batched counts into the sketch, before reading it
+static void hh_batch_merge_all(void)
+{
+    for (m61_stats_shard *shard = __atomic_load_n(&all_shards, __ATOMIC_ACQUIRE);
+         shard; shard = shard->next)
+    {
+        hh_batch_merge(shard);
+    }
+}
+
+// add `sz` bytes in `count` allocations at file:line to this thread's
+// batch
+static void record_HHSite(const char *file, int line, unsigned long long sz, unsigned long long count)
+{
+    m61_stats_shard *shard = m61_shard();
+    m61_hh_batch *batch = shard->hh;
+    if (!batch)
+    {
+        batch = base_malloc(sizeof(m61_hh_batch));
+        if (!batch)
+        {
+            update_HHList(file, line, sz, count);
+            return;
+        }
+        memset(batch, 0, sizeof(m61_hh_batch));
+        pthread_mutex_lock(&shard->hh_lock);
+        shard->hh = batch;
+        pthread_mutex_unlock(&shard->hh_lock);
+    }
+    pthread_mutex_lock(&shard->hh_lock);
+    m61_hh_batch_slot *slot = &batch->slots[hash_site(file, line) & (HH_BATCH_SLOTS - 1)];
+    if (slot->count && (slot->file != file || slot->line != line))
+    {
+        merge_HHBatch(batch);
+    }
+    slot->file = file;
+    slot->line = line;
+    slot->size += sz;
+    slot->count += count;
+    if (++batch->nevents >= HH_BATCH_EVENTS)
+    {
+        merge_HHBatch(batch);
+    }
+    pthread_mutex_unlock(&shard->hh_lock);
+}
+
+// heavy hitter sampling
+// with a sample rate of R bytes, allocated bytes are sampled as a Poisson
+// process: the gaps between sampled bytes are exponentially distributed
+// with mean R (as in tcmalloc). Each thread counts down the bytes until its
+// next sample, so unsampled allocations cost one subtraction. An allocation
+// of sz bytes is sampled with probability p = 1 - exp(-sz/R), so it is
+// recorded as sz/p bytes and 1/p allocations to keep estimates unbiased.
+// A rate of 0 records every allocation exactly.
+size_t m61_sample_rate = 0;
+static __thread long long sample_bytes_left = 0;
+static __thread uint64_t sample_rng = 0;
+
+// xorshift64* pseudo-random numbers, one generator per thread
+static uint64_t sample_random(void)
+{
+    if (sample_rng == 0)
+    {
+        // seed from this thread's state address so threads differ
+        sample_rng = ((uintptr_t)&sample_rng * 0x9E3779B97F4A7C15ULL) | 1;
+    }
+    sample_rng ^= sample_rng >> 12;
+    sample_rng ^= sample_rng << 25;
+    sample_rng ^= sample_rng >> 27;
+    return sample_rng * 0x2545F4914F6CDD1DULL;
+}
+
+// pick the number of bytes until the next sample: exponential with mean
+// m61_sample_rate
+static long long sample_interval(void)
+{
+    // uniform in (0, 1]
+    double u = ((sample_random() >> 11) + 1) * (1.0 / 9007199254740992.0);
+    return (long long)(-log(u) * (double)m61_get_sample_rate()) + 1;
+}
+
+// record a sampled allocation, scaled up by its sampling probability,
+// and start counting down to the next sample
+static void sample_allocation(const char *file, int line, size_t sz)
+{
+    if (sample_bytes_left + (long long)sz > 0)
+    {
+        // the countdown crossed zero during this allocation
+        double p = -expm1(-(double)sz / (double)m61_get_sample_rate());
+        record_HHSite(file, line, (unsigned long long)(sz / p + 0.5),
+                      (unsigned long long)(1 / p + 0.5));
+    }
+    sample_bytes_left = sample_interval();
+}
+
+/// m61_set_sample_rate(rate)
+///    Sample heavy hitters about once every `rate` allocated bytes. 0
+///    records every allocation.
+
+void m61_set_sample_rate(size_t rate)
+{
+    __atomic_store_n(&m61_sample_rate, rate, __ATOMIC_RELAXED);
+    // restart this thread's countdown; other threads pick up the new rate
+    // at their next sample
+    sample_bytes_left = rate ? sample_interval() : 0;
+}
+
+/// m61_get_sample_rate()
+///    Return the current heavy hitter sample rate in bytes.
+
+size_t m61_get_sample_rate(void)
+{
+    return __atomic_load_n(&m61_sample_rate, __ATOMIC_RELAXED);
+}
+
+// read the initial sample rate from the M61_SAMPLE_RATE environment variable
+__attribute__((constructor)) static void m61_sample_rate_init(void)
+{
+    const char *rate = getenv("M61_SAMPLE_RATE");
+    if (rate && *rate)
+    {
+        m61_set_sample_rate(strtoull(rate, NULL, 0));
+    }
+}
+
+// order heavy hitters by decreasing size
+static int compare_heavyhitters(const void *a, const void *b)
+{
+    const struct m61_heavyhitter *ha = a, *hb = b;
+    if (ha->size != hb->size)
+    {
+        return ha->size < hb->size ? 1 : -1;
+    }
+    return 0;
+}
+
+// copy up to `n` monitored call sites into `hh`, largest first, and
+// return the number copied; if `total` is not NULL, also store the bytes
+// the sketch has seen, read under the same lock as the sites
+static size_t heavyhitters_snapshot(struct m61_heavyhitter *hh, size_t n,
+                                    unsigned long long *total)
+{
+    hh_batch_merge_all();
+    pthread_mutex_lock(&HH_lock);
+    struct m61_heavyhitter *all = base_malloc((HH_count + 1) * sizeof(struct m61_heavyhitter));
+    if (!all)
+    {
+        pthread_mutex_unlock(&HH_lock);
+        return 0;
+    }
+    for (size_t i = 0; i < HH_count; ++i)
+    {
+        all[i].file = HH_Counters[i].fileName;
+        all[i].line = HH_Counters[i].lineNumber;
+        all[i].count = HH_Counters[i].HHNum;
+        all[i].size = HH_Counters[i].size;
+        all[i].error = HH_Counters[i].error;
+    }
+    size_t count = HH_count;
+    if (total)
+    {
+        *total = HH_total_bytes;
+    }
+    pthread_mutex_unlock(&HH_lock);
+    qsort(all, count, sizeof(struct m61_heavyhitter), compare_heavyhitters);
+    if (n > count)
+    {
+        n = count;
+    }
+    memcpy(hh, all, n * sizeof(struct m61_heavyhitter));
+    base_free(all);
+    return n;
+}
+
+/// m61_getheavyhitters(hh, n)
+///    Store up to `n` monitored call sites in `hh`, largest first, and
+///    return the number stored.
+
+size_t m61_getheavyhitters(struct m61_heavyhitter *hh, size_t n)
+{
+    return heavyhitters_snapshot(hh, n, NULL);
+}
+
+// allocation traces
+// while a trace is on, every successful malloc, free, realloc and calloc
+// appends a record to a buffer in the thread's stats shard. A full buffer
+// is written to the trace file as one block, under trace_lock; so are
+// partial buffers when their thread exits and when the trace stops. Each
+// buffer has a lock its thread holds while appending, so m61_trace_stop,
+// which may run at exit while other threads still allocate, never flushes
+// half a record, and a writer that finds the trace stopped under that lock
+// drops its record.
+// Addresses and timestamps are stored as varint deltas from the previous
+// record of the block, so a typical record takes under 10 bytes. The
+// format is described in m61.h.
+#define TRACE_BUFSIZE (64 << 10)
+#define TRACE_HEADER 8        // thread slot and length of a block
+#define TRACE_RECORD_MAX 64   // largest record, not counting a site name
+#define TRACE_NAME_MAX 1024   // longer site file names are truncated
+
+typedef struct m61_trace_buffer
+{
+    pthread_mutex_t lock; // held while appending or flushing
+    size_t len;          // bytes used in data, including the block header
+    uintptr_t last_addr; // address in the previous record of the block
+    uint64_t last_time;  // timestamp of the previous record of the block
+    unsigned char data[TRACE_BUFSIZE];
+} m61_trace_buffer;
+
+static FILE *trace_file = NULL;
+static int trace_on = 0;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char trace_site_written[M61_MAXSITES]; // SITE record emitted?
+static __thread int trace_nested = 0; // inside m61_realloc or m61_calloc
+
+// should this thread record an event now?
+#define TRACING() (M61_PROFILING && __atomic_load_n(&trace_on, __ATOMIC_RELAXED) && !trace_nested)
+
+// a timestamp: the TSC where there is one, else nanoseconds
+static uint64_t trace_time(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// append `v` as an unsigned LEB128 varint
+static unsigned char *trace_put(unsigned char *p, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        *p++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char)v;
+    return p;
+}
+
+// append the signed difference `a - b`, zigzag encoded
+static unsigned char *trace_put_delta(unsigned char *p, uintptr_t a, uintptr_t b)
+{
+    int64_t d = (int64_t)(a - b);
+    return trace_put(p, ((uint64_t)d << 1) ^ (uint64_t)(d >> 63));
+}
+
+// write out a shard's buffered records as one block and start a new
+// block; buf->lock must be held
+static void trace_write(m61_stats_shard *shard, m61_trace_buffer *buf)
+{
+    if (buf->len <= TRACE_HEADER)
+    {
+        return;
+    }
+    uint32_t header[2] = {shard->id, (uint32_t)(buf->len - TRACE_HEADER)};
+    for (int i = 0; i < TRACE_HEADER; ++i)
+    {
+        buf->data[i] = (unsigned char)(header[i / 4] >> (8 * (i % 4)));
+    }
+    pthread_mutex_lock(&trace_lock);
+    if (trace_file)
+    {
+        fwrite(buf->data, 1, buf->len, trace_file);
+    }
+    pthread_mutex_unlock(&trace_lock);
+    buf->len = TRACE_HEADER;
+    buf->last_addr = 0;
+    buf->last_time = 0;
+}
+
+// write out a shard's buffered records, if it has any
+static void trace_flush(m61_stats_shard *shard)
+{
+    m61_trace_buffer *buf = __atomic_load_n(&shard->trace, __ATOMIC_ACQUIRE);
+    if (buf)
+    {
+        pthread_mutex_lock(&buf->lock);
+        trace_write(shard, buf);
+        pthread_mutex_unlock(&buf->lock);
+    }
+}
+
+// give a shard a trace buffer. It is published under trace_lock, so a
+// m61_trace_stop either finds it or has already cleared trace_on for its
+// first record to see.
+static m61_trace_buffer *trace_buffer_create(m61_stats_shard *shard)
+{
+    m61_trace_buffer *buf = base_malloc(sizeof(m61_trace_buffer));
+    if (!buf)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&buf->lock, NULL);
+    buf->len = TRACE_HEADER;
+    buf->last_addr = 0;
+    buf->last_time = 0;
+    pthread_mutex_lock(&trace_lock);
+    __atomic_store_n(&shard->trace, buf, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&trace_lock);
+    return buf;
+}
+
+// record one event at file:line. `ptr` is the block allocated or freed;
+// for realloc, `ptr` is the new block and `old_ptr` the released one.
+static void trace_event(int op, const char *file, int line, size_t sz, void *ptr,
+                        size_t old_sz, void *old_ptr)
+{
+    m61_stats_shard *shard = m61_shard();
+    m61_trace_buffer *buf = shard->trace;
+    if (!buf && !(buf = trace_buffer_create(shard)))
+    {
+        return;
+    }
+    pthread_mutex_lock(&buf->lock);
+    // the trace may have stopped since TRACING() was checked
+    if (!__atomic_load_n(&trace_on, __ATOMIC_ACQUIRE))
+    {
+        pthread_mutex_unlock(&buf->lock);
+        return;
+    }
+
+    unsigned site = intern_site(file, line);
+    size_t name_len = 0;
+    int new_site = site && !__atomic_load_n(&trace_site_written[site], __ATOMIC_RELAXED) &&
+                   !__atomic_exchange_n(&trace_site_written[site], 1, __ATOMIC_RELAXED);
+    if (new_site)
+    {
+        name_len = strlen(file);
+        if (name_len > TRACE_NAME_MAX)
+        {
+            name_len = TRACE_NAME_MAX;
+        }
+    }
+    if (buf->len + 2 * TRACE_RECORD_MAX + name_len > TRACE_BUFSIZE)
+    {
+        trace_write(shard, buf);
+    }
+
+    unsigned char *p = buf->data + buf->len;
+    if (new_site)
+    {
+        *p++ = M61_TRACE_SITE;
+        p = trace_put(p, site);
+        p = trace_put(p, line);
+        p = trace_put(p, name_len);
+        memcpy(p, file, name_len);
+        p += name_len;
+    }
+    *p++ = (unsigned char)op;
+    p = trace_put(p, site);
+    p = trace_put(p, sz);
+    if (op == M61_TRACE_REALLOC)
+    {
+        p = trace_put(p, old_sz);
+    }
+    p = trace_put_delta(p, (uintptr_t)ptr, buf->last_addr);
+    if (op == M61_TRACE_REALLOC)
+    {
+        p = trace_put_delta(p, (uintptr_t)old_ptr, (uintptr_t)ptr);
+    }
+    // never step backwards, even if the thread moved to a core whose
+    // clock is slightly behind
+    uint64_t now = trace_time();
+    if (now < buf->last_time)
+    {
+        now = buf->last_time;
+    }
+    p = trace_put(p, now - buf->last_time);
+    buf->last_addr = (uintptr_t)ptr;
+    buf->last_time = now;
+    buf->len = p - buf->data;
+    pthread_mutex_unlock(&buf->lock);
+}
+
+/// m61_trace_stop()
+///    Write out every thread's buffered records and close the trace. Other
+///    threads may keep allocating; a record being written is finished
+///    first and later ones are dropped. Runs automatically at exit.
+
+void m61_trace_stop(void)
+{
+    // after this, every buffer is visible below, and a writer that takes
+    // its buffer lock after the buffer is flushed sees trace_on cleared
+    pthread_mutex_lock(&trace_lock);
+    __atomic_store_n(&trace_on, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&trace_lock);
+    for (m61_stats_shard *shard = __atomic_load_n(&all_shards, __ATOMIC_ACQUIRE);
+         shard; shard = shard->next)
+    {
+        trace_flush(shard);
+    }
+    pthread_mutex_lock(&trace_lock);
+    if (trace_file)
+    {
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/// m61_trace_start(filename)
+///    Start writing a binary trace of every malloc, free, realloc and
+///    calloc to `filename`, ending any trace in progress. Returns 0 on
+///    success, -1 if the file cannot be created.
+
+int m61_trace_start(const char *filename)
+{
+    static int registered = 0;
+    m61_trace_stop();
+    FILE *f = fopen(filename, "wb");
+    if (!f)
+    {
+        return -1;
+    }
+    // blocks are large, so write them straight through; records survive
+    // a crash once their block is written
+    setvbuf(f, NULL, _IONBF, 0);
+    fwrite(M61_TRACE_MAGIC, 1, 8, f);
+    memset(trace_site_written, 0, sizeof(trace_site_written));
+    pthread_mutex_lock(&trace_lock);
+    trace_file = f;
+    if (!registered)
+    {
+        registered = 1;
+        atexit(m61_trace_stop);
+    }
+    pthread_mutex_unlock(&trace_lock);
+    __atomic_store_n(&trace_on, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// start a trace named by the M61_TRACE environment variable
+__attribute__((constructor)) static void m61_trace_init(void)
+{
+    const char *filename = getenv("M61_TRACE");
+    if (filename && *filename && m61_trace_start(filename) != 0)
+    {
+        fprintf(stderr, "m61: cannot create trace file %s\n", filename);
+    }
+}
+
+// lifetime sampling
+// about one allocation in m61_lifetime_rate (geometric intervals, per
+// thread) has its lifetime measured. The birth time of a sampled block
+// goes in lifetime_table, keyed by payload address, since compact metadata
+// has no room for it; the block itself is only flagged. When the block is
+// freed its lifetime, in trace_time() ticks, is added to a log2 histogram
+// for its call site, weighted by the sampling interval so counts and
+// bytes estimate the totals. A full table drops new samples.
+#define LIFETIME_TABLE_SIZE (1 << 16)
+#define LIFETIME_NBINS 65 // bin b holds lifetimes in [2^(b-1), 2^b) ticks
+#define LIFETIME_SHORT_NS 1000000ULL    // freed within 1 ms
+#define LIFETIME_LONG_NS 1000000000ULL  // live for 1 s or more
+
+typedef struct m61_lifetime_entry
+{
+    char *payload;     // NULL if empty
+    uint64_t birth;    // trace_time() at allocation
+    uint64_t weight;   // sampling interval when sampled
+} m61_lifetime_entry;
+
+typedef struct m61_lifetime_site
+{
+    unsigned long long count[LIFETIME_NBINS]; // estimated # objects freed
+    unsigned long long bytes[LIFETIME_NBINS]; // estimated # bytes freed
+} m61_lifetime_site;
+
+size_t m61_lifetime_rate = 64;
+static __thread long long lifetime_countdown = 0;
+static m61_lifetime_entry *lifetime_table = NULL;
+static size_t lifetime_nentries = 0;
+static m61_lifetime_site *lifetime_sites[M61_MAXSITES];
+static unsigned long long lifetime_nsamples = 0;
+static pthread_mutex_t lifetime_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t lifetime_start_ticks; // for converting ticks to ns
+static struct timespec lifetime_start_time;
+
+static size_t lifetime_slot(char *payload)
+{
+    return (((uintptr_t)payload >> 4) * 0x9E3779B97F4A7C15ULL >> 32) & (LIFETIME_TABLE_SIZE - 1);
+}
+
+// pick the number of allocations until the next lifetime sample
+static long long lifetime_interval(size_t rate)
+{
+    if (rate <= 1)
+    {
+        return 1;
+    }
+    double u = ((sample_random() >> 11) + 1) * (1.0 / 9007199254740992.0);
+    return (long long)(-log(u) * (double)rate) + 1;
+}
+
+// maybe start measuring the lifetime of a newly allocated block
+static void lifetime_sample(struct m61_metadata *metadata)
+{
+    if (!M61_PROFILING || --lifetime_countdown > 0)
+    {
+        return;
+    }
+    size_t rate = __atomic_load_n(&m61_lifetime_rate, __ATOMIC_RELAXED);
+    lifetime_countdown = lifetime_interval(rate);
+    if (rate == 0)
+    {
+        // checked only when the countdown runs out, so a rate of 0 costs
+        // one decrement per allocation
+        lifetime_countdown = 1 << 16;
+        return;
+    }
+
+    char *payload = (char *)(metadata + 1);
+    pthread_mutex_lock(&lifetime_lock);
+    if (!lifetime_table)
+    {
+        lifetime_table = base_malloc(LIFETIME_TABLE_SIZE * sizeof(m61_lifetime_entry));
+        if (lifetime_table)
+        {
+            memset(lifetime_table, 0, LIFETIME_TABLE_SIZE * sizeof(m61_lifetime_entry));
+            lifetime_start_ticks = trace_time();
+            clock_gettime(CLOCK_MONOTONIC, &lifetime_start_time);
+        }
+    }
+    if (lifetime_table && lifetime_nentries < LIFETIME_TABLE_SIZE * 3 / 4)
+    {
+        size_t i = lifetime_slot(payload);
+        while (lifetime_table[i].payload)
+        {
+            i = (i + 1) & (LIFETIME_TABLE_SIZE - 1);
+        }
+        lifetime_table[i].payload = payload;
+        lifetime_table[i].birth = trace_time();
+        lifetime_table[i].weight = rate;
+        ++lifetime_nentries;
+        ++lifetime_nsamples;
+        set_metadata_sampled(metadata);
+    }
+    pthread_mutex_unlock(&lifetime_lock);
+}
+
+// remove table entry `i`, shifting later entries of its probe run back
+static void lifetime_remove(size_t i)
+{
+    size_t mask = LIFETIME_TABLE_SIZE - 1;
+    size_t j = i;
+    while (1)
+    {
+        j = (j + 1) & mask;
+        if (!lifetime_table[j].payload)
+        {
+            break;
+        }
+        size_t home = lifetime_slot(lifetime_table[j].payload);
+        // entry j may move to i only if its home slot is not in (i, j]
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            lifetime_table[i] = lifetime_table[j];
+            i = j;
+        }
+    }
+    lifetime_table[i].payload = NULL;
+    --lifetime_nentries;
+}
+
+// the histogram bin of a lifetime of `ticks`
+static int lifetime_bin(uint64_t ticks)
+{
+    return ticks ? 64 - __builtin_clzll(ticks) : 0;
+}
+
+// a sampled block is being freed: add its lifetime to its site
+static void lifetime_record(struct m61_metadata *metadata)
+{
+    uint64_t now = trace_time();
+    char *payload = (char *)(metadata + 1);
+    unsigned site = metadata_site(metadata);
+    pthread_mutex_lock(&lifetime_lock);
+    size_t i = lifetime_slot(payload);
+    while (lifetime_table[i].payload && lifetime_table[i].payload != payload)
+    {
+        i = (i + 1) & (LIFETIME_TABLE_SIZE - 1);
+    }
+    if (lifetime_table[i].payload)
+    {
+        m61_lifetime_site *ls = lifetime_sites[site];
+        if (!ls && (ls = base_malloc(sizeof(m61_lifetime_site))))
+        {
+            memset(ls, 0, sizeof(m61_lifetime_site));
+            lifetime_sites[site] = ls;
+        }
+        if (ls)
+        {
+            int b = lifetime_bin(now - lifetime_table[i].birth);
+            ls->count[b] += lifetime_table[i].weight;
+            ls->bytes[b] += lifetime_table[i].weight * metadata->size;
+        }
+        lifetime_remove(i);
+    }
+    pthread_mutex_unlock(&lifetime_lock);
+}
+
+/// m61_set_lifetime_sample(rate)
+///    Measure the lifetime of about one allocation in `rate`. 1 measures
+///    every allocation, 0 none.
+
+void m61_set_lifetime_sample(size_t rate)
+{
+    __atomic_store_n(&m61_lifetime_rate, rate, __ATOMIC_RELAXED);
+    // restart this thread's countdown; other threads pick up the new rate
+    // at their next sample
+    lifetime_countdown = lifetime_interval(rate);
+}
+
+// read the lifetime sampling rate from M61_LIFETIME_SAMPLE
+__attribute__((constructor)) static void m61_lifetime_init(void)
+{
+    const char *rate = getenv("M61_LIFETIME_SAMPLE");
+    if (rate && *rate)
+    {
+        m61_set_lifetime_sample(strtoull(rate, NULL, 0));
+    }
+}
+
+// stack sampling
+// allocated bytes are sampled like heavy hitters, about once every
+// m61_stack_rate bytes (1 records every allocation, and 0, the default,
+// turns this off), and the allocation holding a sampled byte
+// records a backtrace of up to M61_STACK_DEPTH frames, starting at the
+// code that called m61. glibc's backtrace() uses the unwind tables, so it
+// works without frame pointers; __builtin_return_address(0) in the public
+// entry points marks where m61's own frames end. Backtraces are interned
+// like call sites: the block stores only a 32-bit stack id, and equal
+// backtraces share one entry in m61_stacks. Id 0 means no backtrace (or
+// the table is full). Each stack also counts the sampled allocations and
+// bytes allocated there, scaled up by their sampling probability, for the
+// heavy hitter report.
+#define M61_STACK_DEPTH 8
+#define M61_MAXSTACKS (1 << 16)
+
+typedef struct m61_stack
+{
+    void *pc[M61_STACK_DEPTH]; // return addresses, innermost first
+    unsigned depth;
+    uint64_t hash;
+    unsigned long long count;  // estimated # allocations with this stack
+    unsigned long long bytes;  // estimated # bytes allocated with this stack
+} m61_stack;
+
+size_t m61_stack_rate = 0;
+static __thread long long stack_bytes_left = 0;
+static m61_stack m61_stacks[M61_MAXSTACKS];
+static unsigned m61_nstacks = 1;
+static unsigned m61_stack_index[2 * M61_MAXSTACKS]; // stack id, 0 if empty
+static pthread_mutex_t stacks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t hash_stack(void **pc, unsigned depth)
+{
+    uint64_t h = depth;
+    for (unsigned i = 0; i < depth; ++i)
+    {
+        h = (h ^ (uintptr_t)pc[i]) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+// look for a backtrace in the stack index; return its id, or 0 and the
+// empty slot where it belongs
+static unsigned find_stack(void **pc, unsigned depth, uint64_t h, size_t *slot)
+{
+    size_t i = h & (2 * M61_MAXSTACKS - 1);
+    unsigned id;
+    while ((id = __atomic_load_n(&m61_stack_index[i], __ATOMIC_ACQUIRE)) != 0)
+    {
+        if (m61_stacks[id].hash == h && m61_stacks[id].depth == depth &&
+            memcmp(m61_stacks[id].pc, pc, depth * sizeof(void *)) == 0)
+        {
+            return id;
+        }
+        i = (i + 1) & (2 * M61_MAXSTACKS - 1);
+    }
+    *slot = i;
+    return 0;
+}
+
+// return the id of a backtrace, adding it to the table if it is new
+static unsigned intern_stack(void **pc, unsigned depth)
+{
+    uint64_t h = hash_stack(pc, depth);
+    size_t slot;
+    unsigned id = find_stack(pc, depth, h, &slot);
+    if (id)
+    {
+        return id;
+    }
+    pthread_mutex_lock(&stacks_lock);
+    // another thread may have added it since we looked
+    id = find_stack(pc, depth, h, &slot);
+    if (!id && m61_nstacks < M61_MAXSTACKS)
+    {
+        id = m61_nstacks++;
+        memcpy(m61_stacks[id].pc, pc, depth * sizeof(void *));
+        m61_stacks[id].depth = depth;
+        m61_stacks[id].hash = h;
+        __atomic_store_n(&m61_stack_index[slot], id, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&stacks_lock);
+    return id;
+}
+
+// the stack id of a block, 0 if none
+static unsigned metadata_stack(struct m61_metadata *metadata)
+{
+#if M61_COMPACT
+    return metadata->state >> 32;
+#else
+    return metadata->stack;
+#endif
+}
+
+static void set_metadata_stack(struct m61_metadata *metadata, unsigned id)
+{
+#if M61_COMPACT
+    metadata->state = (metadata->state & 0xFFFFFFFFULL) | (uint64_t)id << 32;
+#else
+    metadata->stack = id;
+#endif
+}
+
+// pick the number of bytes until the next stack sample; while sampling is
+// off, look at the rate again every 16 MiB
+static long long stack_interval(size_t rate)
+{
+    if (rate == 0)
+    {
+        return 1 << 24;
+    }
+    return rate == 1 ? 0 : lifetime_interval(rate);
+}
+
+// maybe record the backtrace of a new block of `sz` bytes. `caller` is
+// the return address of the public m61 function called by the program.
+static void stack_sample(struct m61_metadata *metadata, size_t sz, void *caller)
+{
+    // off or between samples costs one subtraction
+    if (!M61_PROFILING || (stack_bytes_left -= (long long)sz) > 0)
+    {
+        return;
+    }
+    size_t rate = __atomic_load_n(&m61_stack_rate, __ATOMIC_RELAXED);
+    // did the countdown cross zero during this allocation, or was it
+    // already spent (a new thread, or a rate change)?
+    int crossed = stack_bytes_left + (long long)sz > 0;
+    stack_bytes_left = stack_interval(rate);
+    if (rate == 0 || (rate > 1 && !crossed))
+    {
+        return;
+    }
+    // an allocation of sz bytes is sampled with probability
+    // p = 1 - exp(-sz/rate); scale it up by 1/p, as for heavy hitters
+    double p = rate == 1 ? 1 : -expm1(-(double)sz / (double)rate);
+
+    void *frames[M61_STACK_DEPTH + 16];
+    int n = backtrace(frames, M61_STACK_DEPTH + 16);
+    // drop m61's own frames
+    int first = 0;
+    while (first < n && frames[first] != caller)
+    {
+        ++first;
+    }
+    if (first == n)
+    {
+        // inlined or unwound differently: keep just the caller
+        frames[0] = caller;
+        first = 0;
+        n = 1;
+    }
+    unsigned depth = n - first < M61_STACK_DEPTH ? n - first : M61_STACK_DEPTH;
+    unsigned id = intern_stack(frames + first, depth);
+    if (id)
+    {
+        set_metadata_stack(metadata, id);
+        __atomic_fetch_add(&m61_stacks[id].count, (unsigned long long)(1 / p + 0.5), __ATOMIC_RELAXED);
+        __atomic_fetch_add(&m61_stacks[id].bytes, (unsigned long long)(sz / p + 0.5), __ATOMIC_RELAXED);
+    }
+}
+
+// print the frames of stack `id`, one per line, through stdout
+static void print_stack(unsigned id)
+{
+    fflush(stdout);
+    backtrace_symbols_fd(m61_stacks[id].pc, m61_stacks[id].depth, STDOUT_FILENO);
+}
+
+/// m61_set_stack_sample(rate)
+///    Record backtraces about once every `rate` allocated bytes. 1 records
+///    every allocation, 0 none.
+
+void m61_set_stack_sample(size_t rate)
+{
+    __atomic_store_n(&m61_stack_rate, rate, __ATOMIC_RELAXED);
+    // restart this thread's countdown; other threads pick up the new rate
+    // at their next sample
+    stack_bytes_left = stack_interval(rate);
+}
+
+// read the stack sampling rate from M61_STACK_SAMPLE
+__attribute__((constructor)) static void m61_stack_init(void)
+{
+    const char *rate = getenv("M61_STACK_SAMPLE");
+    if (rate && *rate)
+    {
+        m61_set_stack_sample(strtoull(rate, NULL, 0));
+    }
+}
+
+// count an allocation of `sz` bytes at file:line in the heavy hitter sketch
+static void record_allocation(const char *file, int line, size_t sz)
+{
+    if (!M61_TRACKING)
+    {
+        return;
+    }
+    if (__atomic_load_n(&m61_sample_rate, __ATOMIC_RELAXED) == 0)
+    {
+        record_HHSite(file, line, sz, 1);
+    }
+    else if ((sample_bytes_left -= (long long)sz) <= 0)
+    {
+        sample_allocation(file, line, sz);
+    }
+}
+
+// largest allocation allowed: blocks must stay under 2^32-1 bytes
+// 2^32-1 is maximum value for 32-bit unsigned Int. The -1 is because
+// integers start at 0 but counting starts at 1
+#define M61_SIZE_LIMIT ((pow(2, 32) - 1) - sizeof(struct m61_statistics) - sizeof(m61_overflow_buffer))
+
+// allocate `sz` bytes with room to grow by at least `slack` more in place,
+// aligned to `align` bytes (a power of 2; every payload is 16-byte aligned)
+// `caller` is the return address of the m61 function the program called
+static void *allocate(size_t sz, size_t slack, size_t align, const char *file, int line, void *caller)
+{
+    (void)file, (void)line; // avoid uninitialized variable warnings
+
+    m61_stats_shard *shard = m61_shard();
+
+    // room to move the payload up to an `align` boundary
+    size_t pad = align > 16 ? align - 16 : 0;
+
+    // Prevent integer overflow: check to make sure sz not greater than 2^32-1
+    if (sz > M61_SIZE_LIMIT || pad > M61_MAXSLACK || sz + pad > M61_SIZE_LIMIT)
+    {
+        SHARD_ADD(shard, nfail, 1);
+        SHARD_ADD(shard, fail_size, sz);
+        return NULL;
+    }
+    if (slack > M61_MAXSLACK || sz + pad + slack > M61_SIZE_LIMIT)
+    {
+        slack = 0;
+    }
+    // Add extra space to check for errors
+    m61_overflow_buffer buffer = {1111};
+
+    // an aligned payload could not end against a guard page
+    int guarded = M61_CHECKS && !pad && guard_applies(sz);
+    int mapped = !guarded && mapped_applies(sz);
+    // rounding a mapped block up to whole pages adds up to a page of slack
+    if (mapped && slack + pad + page_size > M61_MAXSLACK)
+    {
+        slack = 0;
+        mapped = pad + page_size <= M61_MAXSLACK;
+    }
+
+    // create extra space for pointer for metadata and overflow checker
+    size_t total = sizeof(struct m61_metadata) + sz + slack + pad + sizeof(m61_overflow_buffer);
+    char *block;
+    if (guarded)
+    {
+        block = (char *)guard_alloc(sz);
+    }
+    else if (mapped)
+    {
+        block = mapped_alloc(&total);
+    }
+    else
+    {
+        block = cache_alloc(&total);
+    }
+    if (!block)
+    {
+        SHARD_ADD(shard, nfail, 1);
+        SHARD_ADD(shard, fail_size, sz);
+        return NULL;
+    }
+    struct m61_metadata *ptr = (struct m61_metadata *)block;
+    if (pad)
+    {
+        uintptr_t payload = ((uintptr_t)block + sizeof(struct m61_metadata) + align - 1) & ~(uintptr_t)(align - 1);
+        ptr = (struct m61_metadata *)payload - 1;
+    }
+    // the backend may have rounded the block up; a guarded block cannot grow
+    slack = guarded ? 0 : block + total - (char *)(ptr + 1) - sz - sizeof(m61_overflow_buffer);
+
+    // put data into metadata
+    init_metadata(ptr, sz, slack, file, line);
+    if ((char *)ptr != block)
+    {
+        ((char **)ptr)[-1] = block;
+        set_metadata_aligned(ptr);
+    }
+    if (mapped)
+    {
+        set_metadata_mapped(ptr);
+    }
+
+    // track stats
+    SHARD_ADD(shard, nactive, 1);
+    SHARD_ADD(shard, ntotal, 1);
+    SHARD_ADD(shard, active_size, sz);
+    SHARD_ADD(shard, total_size, sz);
+
+    // min points to the beginning of the allocated data
+    // max points to the end.
+    // update heap_min if there is only a new minimum
+    // update heap_max if there is only a new max
+    update_heap_bounds((char *)ptr, (char *)ptr + sz + slack + sizeof(struct m61_metadata));
+
+    //  Store buffer at the end of allocated pointer (a guarded block
+    //  has its guard page there instead)
+    if (guarded)
+    {
+        set_metadata_guarded(ptr);
+    }
+    else if (M61_CHECKS)
+    {
+        m61_overflow_buffer *buffer_ptr = (m61_overflow_buffer *)((char *)(ptr + 1) + sz);
+        *buffer_ptr = buffer;
+    }
+
+    track_active(ptr);
+    lifetime_sample(ptr);
+    stack_sample(ptr, sz, caller);
+
+    // add to heavy hitter sketch
+    record_allocation(file, line, sz);
+    if (TRACING())
+    {
+        trace_event(M61_TRACE_MALLOC, file, line, sz, ptr + 1, 0, NULL);
+    }
+    //  magic
+    //  increment by the size of the pointer value in this case char?
+    return ptr + 1;
+}
+
+// void pointer gives us first address of this byte
+// get byte of memory of sz
+void *m61_malloc(size_t sz, const char *file, int line)
+{
+    return allocate(sz, 0, 0, file, line, __builtin_return_address(0));
+}
+
+// allocate `sz` bytes aligned to `align`, failing if `align` is not a
+// power of 2
+static void *allocate_aligned(size_t align, size_t sz, const char *file, int line, void *caller)
+{
+    if (align == 0 || (align & (align - 1)) != 0)
+    {
+        m61_stats_shard *shard = m61_shard();
+        SHARD_ADD(shard, nfail, 1);
+        SHARD_ADD(shard, fail_size, sz);
+        return NULL;
+    }
+    return allocate(sz, 0, align, file, line, caller);
+}
+
+/// m61_memalign(align, sz, file, line)
+///    Return a pointer to `sz` bytes of newly-allocated dynamic memory
+///    whose address is a multiple of `align`, or NULL if `align` is not a
+///    power of 2. The block is freed with `m61_free` like any other. The
+///    allocation request was at location `file`:`line`.
+
+void *m61_memalign(size_t align, size_t sz, const char *file, int line)
+{
+    return allocate_aligned(align, sz, file, line, __builtin_return_address(0));
+}
+
+/// m61_aligned_alloc(align, sz, file, line)
+///    The C11 spelling of `m61_memalign`. As in C17, `sz` need not be a
+///    multiple of `align`.
+
+void *m61_aligned_alloc(size_t align, size_t sz, const char *file, int line)
+{
+    return allocate_aligned(align, sz, file, line, __builtin_return_address(0));
+}
+
+// check that `ptr`, about to be freed or resized, is an intact active
+// block. Report and abort if it is not; report a double free and return
+// NULL if it was freed already. Otherwise return its metadata.
+static struct m61_metadata *check_block(void *ptr, const char *file, int line)
+{
+    if (!M61_CHECKS)
+    {
+        return (struct m61_metadata *)ptr - 1;
+    }
+    // if the heap > ptr force an abort
+    if ((void *)__atomic_load_n(&heap_min, __ATOMIC_RELAXED) > ptr ||
+        (void *)__atomic_load_n(&heap_max, __ATOMIC_RELAXED) < ptr)
+    {
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not in heap\n", file, line, ptr);
+        abort();
+    }
+
+    // ask the live map before touching any metadata
+    int state = livemap_state(ptr);
+    if (state == LIVEMAP_FREED)
+    {
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, double free\n", file, line, ptr);
+        return NULL;
+    }
+    if (state != LIVEMAP_LIVE)
+    {
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated\n", file, line, ptr);
+        // if the pointer is inside an active block, say which
+        char *payload = livemap_find_before((uintptr_t)ptr, (uintptr_t)__atomic_load_n(&heap_min, __ATOMIC_RELAXED));
+        if (payload)
+        {
+            struct m61_metadata *enclosing = (struct m61_metadata *)payload - 1;
+            if ((char *)ptr < payload + enclosing->size)
+            {
+                fprintf(stderr, "  %s:%d: %p is %zu bytes inside a %llu byte region allocated here\n",
+                        metadata_file(enclosing), metadata_line(enclosing), ptr,
+                        (size_t)((char *)ptr - payload), (unsigned long long)enclosing->size);
+            }
+        }
+        abort();
+    }
+
+    // grab the remaining space set to new pointer
+    struct m61_metadata *metadata_ptr = (struct m61_metadata *)ptr - 1;
+
+    // the metadata itself was overwritten
+    if (!metadata_intact(metadata_ptr, ptr))
+    {
+        fprintf(stderr, "MEMORY BUG: %s:%d: detected wild write during free of pointer %p\n", file, line, ptr);
+        abort();
+    }
+
+    // test 28
+    // check for overflow (past a guarded block, check the padding before
+    // its guard page)
+    m61_overflow_buffer *buffer_ptr = (m61_overflow_buffer *)((char *)ptr + metadata_ptr->size);
+    if (metadata_guarded(metadata_ptr) ? !guard_fill_intact(metadata_ptr) : buffer_ptr->buffer != 1111)
+    {
+
+        fprintf(stderr, "MEMORY BUG: %s:%d: detected wild write during free of pointer %p\n", file, line, ptr);
+        abort();
+    }
+    return metadata_ptr;
+}
+
+void m61_free(void *ptr, const char *file, int line)
+{
+    (void)file, (void)line; // avoid uninitialized variable warnings
+    if (!ptr)
+    {
+        return;
+    }
+    struct m61_metadata *metadata_ptr = check_block(ptr, file, line);
+    if (!metadata_ptr)
+    {
+        return;
+    }
+
+    // if another thread freed the block first, print ERROR message
+    if (!untrack_active(metadata_ptr))
+    {
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, double free\n", file, line, ptr);
+        return;
+    }
+
+    if (M61_PROFILING && metadata_sampled(metadata_ptr))
+    {
+        lifetime_record(metadata_ptr);
+    }
+
+    m61_stats_shard *shard = m61_shard();
+    SHARD_ADD(shard, nactive, -1);
+    SHARD_ADD(shard, active_size, -(unsigned long long)metadata_ptr->size);
+    if (TRACING())
+    {
+        trace_event(M61_TRACE_FREE, file, line, metadata_ptr->size, ptr, 0, NULL);
+    }
+    if (M61_CHECKS && metadata_guarded(metadata_ptr))
+    {
+        guard_free(metadata_ptr);
+    }
+    else if (metadata_mapped(metadata_ptr))
+    {
+        mapped_free(block_base(metadata_ptr), block_total(metadata_ptr));
+    }
+    else
+    {
+        quarantine_push(shard, metadata_ptr);
+    }
+}
+
+/// m61_malloc_batch(ptrs, n, sz, file, line)
+///    Allocate `n` blocks of `sz` bytes each, storing pointers to them in
+///    `ptrs[0]` through `ptrs[n-1]`, and return the number allocated; any
+///    remaining entries are set to NULL. Each block can be freed on its
+///    own. The allocation request was at location `file`:`line`.
+
+size_t m61_malloc_batch(void **ptrs, size_t n, size_t sz, const char *file, int line)
+{
+    m61_stats_shard *shard = m61_shard();
+    size_t got = 0;
+    if ((M61_CHECKS && guard_applies(sz)) || mapped_applies(sz))
+    {
+        // guarded and mapped blocks get a mapping each, so there is no
+        // batch path
+        while (got < n && (ptrs[got] = allocate(sz, 0, 0, file, line, __builtin_return_address(0))))
+        {
+            ++got;
+        }
+        if (got < n)
+        {
+            // allocate counted the first failure
+            SHARD_ADD(shard, nfail, n - got - 1);
+            SHARD_ADD(shard, fail_size, (n - got - 1) * sz);
+            memset(ptrs + got, 0, (n - got) * sizeof(void *));
+        }
+        return got;
+    }
+    size_t total = sizeof(struct m61_metadata) + sz + sizeof(m61_overflow_buffer);
+    if (sz <= M61_SIZE_LIMIT)
+    {
+        // the metadata pointers go in `ptrs` until the blocks are set up;
+        // like cache_alloc, take this thread's cached blocks first
+        int c = tcache_class(total);
+        if (c >= 0)
+        {
+            total = slab_class_size[c];
+            if (shard->tcache)
+            {
+                got = tcache_pop(shard->tcache, c, ptrs, n);
+            }
+        }
+        got += backend_alloc_batch(&total, ptrs + got, n - got);
+    }
+    size_t slack = total - sizeof(struct m61_metadata) - sz - sizeof(m61_overflow_buffer);
+    m61_overflow_buffer buffer = {1111};
+    char *lo = NULL, *hi = NULL;
+    for (size_t i = 0; i < got; ++i)
+    {
+        struct m61_metadata *metadata = ptrs[i];
+        init_metadata(metadata, sz, slack, file, line);
+        if (M61_CHECKS)
+        {
+            *(m61_overflow_buffer *)((char *)(metadata + 1) + sz) = buffer;
+        }
+        lifetime_sample(metadata);
+        stack_sample(metadata, sz, __builtin_return_address(0));
+        if (!lo || (char *)metadata < lo)
+        {
+            lo = (char *)metadata;
+        }
+        if ((char *)metadata + sizeof(struct m61_metadata) + sz + slack > hi)
+        {
+            hi = (char *)metadata + sizeof(struct m61_metadata) + sz + slack;
+        }
+    }
+    if (got)
+    {
+        update_heap_bounds(lo, hi);
+        track_active_batch((struct m61_metadata **)ptrs, got);
+    }
+
+    SHARD_ADD(shard, nactive, got);
+    SHARD_ADD(shard, ntotal, got);
+    SHARD_ADD(shard, active_size, got * sz);
+    SHARD_ADD(shard, total_size, got * sz);
+    SHARD_ADD(shard, nfail, n - got);
+    SHARD_ADD(shard, fail_size, (n - got) * sz);
+    if (!M61_TRACKING)
+    {
+        // no heavy hitter sketch
+    }
+    else if (__atomic_load_n(&m61_sample_rate, __ATOMIC_RELAXED) == 0)
+    {
+        if (got)
+        {
+            record_HHSite(file, line, got * sz, got);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < got; ++i)
+        {
+            if ((sample_bytes_left -= (long long)sz) <= 0)
+            {
+                sample_allocation(file, line, sz);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        ptrs[i] = i < got ? (struct m61_metadata *)ptrs[i] + 1 : NULL;
+        if (i < got && TRACING())
+        {
+            trace_event(M61_TRACE_MALLOC, file, line, sz, ptrs[i], 0, NULL);
+        }
+    }
+    return got;
+}
+
+/// m61_free_batch(ptrs, n, file, line)
+///    Free the `n` blocks pointed to by `ptrs[0]` through `ptrs[n-1]`,
+///    checking each as `m61_free` would. NULL entries are ignored. The
+///    free was called at location `file`:`line`.
+
+void m61_free_batch(void **ptrs, size_t n, const char *file, int line)
+{
+    m61_stats_shard *shard = m61_shard();
+    struct m61_metadata *chunk[M61_BATCH_CHUNK];
+    for (size_t base = 0; base < n; base += M61_BATCH_CHUNK)
+    {
+        size_t end = n - base < M61_BATCH_CHUNK ? n : base + M61_BATCH_CHUNK;
+        size_t count = 0;
+        unsigned long long bytes = 0;
+        for (size_t i = base; i < end; ++i)
+        {
+            if (!ptrs[i])
+            {
+                continue;
+            }
+            struct m61_metadata *metadata = check_block(ptrs[i], file, line);
+            if (!metadata)
+            {
+                continue;
+            }
+            // a block listed twice, or freed by another thread meanwhile
+            if (M61_CHECKS && !livemap_clear(ptrs[i]))
+            {
+                fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, double free\n", file, line, ptrs[i]);
+                continue;
+            }
+            chunk[count++] = metadata;
+            bytes += metadata->size;
+        }
+        untrack_active_batch(chunk, count);
+        SHARD_ADD(shard, nactive, -(unsigned long long)count);
+        SHARD_ADD(shard, active_size, -bytes);
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (M61_PROFILING && metadata_sampled(chunk[i]))
+            {
+                lifetime_record(chunk[i]);
+            }
+            if (TRACING())
+            {
+                trace_event(M61_TRACE_FREE, file, line, chunk[i]->size, chunk[i] + 1, 0, NULL);
+            }
+            if (M61_CHECKS && metadata_guarded(chunk[i]))
+            {
+                guard_free(chunk[i]);
+            }
+            else if (metadata_mapped(chunk[i]))
+            {
+                mapped_free(block_base(chunk[i]), block_total(chunk[i]));
+            }
+            else
+            {
+                quarantine_push(shard, chunk[i]);
+            }
+        }
+    }
+}
+
+// resize the active block `metadata` to `sz` bytes without moving it, if
+// it has room and would not waste more than half its space; return 1 if
+// it was resized. Counts as an allocation, like a moving realloc.
+static int resize_in_place(struct m61_metadata *metadata, size_t sz, const char *file, int line)
+{
+    size_t capacity = metadata->size + metadata->slack;
+    // a guarded block must keep its end against its guard page
+    if ((M61_CHECKS && metadata_guarded(metadata)) || sz > capacity || capacity - sz > M61_MAXSLACK || sz < capacity / 2)
+    {
+        return 0;
+    }
+    m61_stats_shard *shard = m61_shard();
+    SHARD_ADD(shard, ntotal, 1);
+    SHARD_ADD(shard, total_size, sz);
+    SHARD_ADD(shard, active_size, sz - metadata->size);
+    metadata->slack = capacity - sz;
+    metadata->size = sz;
+    // move the overflow buffer to the new end
+    if (M61_CHECKS)
+    {
+        m61_overflow_buffer *buffer_ptr = (m61_overflow_buffer *)((char *)(metadata + 1) + sz);
+        buffer_ptr->buffer = 1111;
+    }
+    record_allocation(file, line, sz);
+    return 1;
+}
+
+// resize `ptr` to `sz` bytes as m61_realloc does; `caller` is the return
+// address of the m61 function the program called
+static void *reallocate(void *ptr, size_t sz, const char *file, int line, void *caller)
+{
+    size_t old_sz = 0;
+    if (ptr)
+    {
+        // report an invalid `ptr` before we use its metadata
+        struct m61_metadata *metadata = check_block(ptr, file, line);
+        if (!metadata)
+        {
+            return NULL;
+        }
+        old_sz = metadata->size;
+        if (sz && resize_in_place(metadata, sz, file, line))
+        {
+            if (TRACING())
+            {
+                trace_event(M61_TRACE_REALLOC, file, line, sz, ptr, old_sz, ptr);
+            }
+            return ptr;
+        }
+    }
+    // the malloc and free below are traced as one realloc
+    ++trace_nested;
+    void *new_ptr = NULL;
+    if (sz)
+    {
+        // a block that outgrew its space will likely grow again, so give
+        // it room to grow in place: total copying stays linear in its size
+        new_ptr = allocate(sz, ptr && sz > old_sz ? sz / 2 : 0, 0, file, line, caller);
+    }
+    if (ptr && new_ptr)
+    {
+        // Copy the data from `ptr` into `new_ptr`.
+        if (old_sz <= sz)
+            memcpy(new_ptr, ptr, old_sz);
+        else
+            memcpy(new_ptr, ptr, sz);
+    }
+    m61_free(ptr, file, line);
+    --trace_nested;
+    if (TRACING())
+    {
+        trace_event(M61_TRACE_REALLOC, file, line, new_ptr ? sz : 0, new_ptr, old_sz, ptr);
+    }
+    return new_ptr;
+}
+
+/// m61_realloc(ptr, sz, file, line)
+///    Reallocate the dynamic memory pointed to by `ptr` to hold at least
+///    `sz` bytes, returning a pointer to the new block. If `ptr` is NULL,
+///    behaves like `m61_malloc(sz, file, line)`. If `sz` is 0, behaves
+///    like `m61_free(ptr, file, line)`. A block that has room is resized
+///    in place. The allocation request was at location `file`:`line`.
+
+void *m61_realloc(void *ptr, size_t sz, const char *file, int line)
+{
+    return reallocate(ptr, sz, file, line, __builtin_return_address(0));
+}
+
+// allocate a zeroed array as m61_calloc does; `caller` is the return
+// address of the m61 function the program called
+static void *allocate_zeroed(size_t nmemb, size_t sz, const char *file, int line, void *caller)
+{
+    // Your code here (to fix test016).
+    // maximum number of a possible unsigned int
+    unsigned int maximum_int = -1;
+    // if nmemb * sz > maximum_int force a fail
+    // because nmemb * sz is an int that means if that multiplication
+    // happens to be bigger than an int then it will overflow and the
+    // result will wrap around 0.
+    // (an empty array cannot overflow, and must not divide by zero)
+    if (nmemb && sz && (nmemb > maximum_int / sz || sz > maximum_int / nmemb))
+    {
+        SHARD_ADD(m61_shard(), nfail, 1);
+        return NULL;
+    }
+    ++trace_nested;
+    void *ptr = allocate(nmemb * sz, 0, 0, file, line, caller);
+    --trace_nested;
+    if (ptr)
+    {
+        memset(ptr, 0, nmemb * sz);
+        if (TRACING())
+        {
+            trace_event(M61_TRACE_CALLOC, file, line, nmemb * sz, ptr, 0, NULL);
+        }
+    }
+    return ptr;
+}
+
+/// m61_calloc(nmemb, sz, file, line)
+///    Return a pointer to newly-allocated dynamic memory big enough to
+///    hold an array of `nmemb` elements of `sz` bytes each. The memory
+///    is initialized to zero. If `sz == 0`, then m61_malloc may
+///    either return NULL or a unique, newly-allocated pointer value.
+///    The allocation request was at location `file`:`line`.
+
+void *m61_calloc(size_t nmemb, size_t sz, const char *file, int line)
+{
+    return allocate_zeroed(nmemb, sz, file, line, __builtin_return_address(0));
+}
+
+// arenas
+// an arena hands out objects by bumping a pointer through chunks obtained
+// from base_malloc, and releases them all at once on reset or destroy.
+// Objects are not tracked one by one (they never enter the live map or
+// the active lists); instead each arena remembers where it was created and
+// how much it holds, and live arenas are kept on a list for the leak
+// report. With M61_ARENA_CANARY each object is preceded by a small header
+// and followed by a canary, and every canary is checked on reset and
+// destroy.
+#define ARENA_MAGIC 0x61A7E4A61A7E4A00ULL
+#define ARENA_CHUNK_SIZE (64 << 10) // default chunk size
+#define ARENA_ALIGN 16
+
+typedef struct m61_arena_chunk
+{
+    struct m61_arena_chunk *next; // next older chunk
+    char *top;                    // next free byte
+    char *end;                    // end of the chunk
+    char *padding;                // keep objects 16-byte aligned
+} m61_arena_chunk;
+
+// header of an object in a canary arena; the canary follows the payload
+typedef struct m61_arena_object
+{
+    const char *file; // where the object was allocated
+    uint32_t line;
+    uint32_t size;    // number of bytes in the object
+} m61_arena_object;
+
+struct m61_arena
+{
+    uint64_t magic;                // ARENA_MAGIC while the arena is live
+    const char *file;              // where the arena was created
+    int line;
+    int flags;                     // M61_ARENA_ flags
+    m61_arena_chunk *chunks;       // newest chunk first
+    unsigned long long nobjects;   // # objects since created or reset
+    unsigned long long size;       // # bytes in those objects
+    unsigned long long chunk_size; // # bytes in chunks
+    struct m61_arena *prev;        // previous arena in live_arenas
+    struct m61_arena *next;        // next arena in live_arenas
+};
+
+static m61_arena *live_arenas = NULL;
+static pthread_mutex_t arenas_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// report and abort unless `arena` is a live arena
+static void check_arena(m61_arena *arena, const char *file, int line)
+{
+    if (!arena || arena->magic != ARENA_MAGIC)
+    {
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid arena %p\n", file, line, (void *)arena);
+        abort();
+    }
+}
+
+// check every canary in `arena`, reporting and aborting on the first
+// overwritten one
+static void check_arena_canaries(m61_arena *arena, const char *file, int line)
+{
+    if (!(arena->flags & M61_ARENA_CANARY))
+    {
+        return;
+    }
+    for (m61_arena_chunk *chunk = arena->chunks; chunk != NULL; chunk = chunk->next)
+    {
+        char *p = (char *)(chunk + 1);
+        while (p < chunk->top)
+        {
+            m61_arena_object *object = (m61_arena_object *)p;
+            char *payload = (char *)(object + 1);
+            m61_overflow_buffer *buffer_ptr = (m61_overflow_buffer *)(payload + object->size);
+            if ((char *)buffer_ptr + sizeof(m61_overflow_buffer) > chunk->top || buffer_ptr->buffer != 1111)
+            {
+                fprintf(stderr, "MEMORY BUG: %s:%d: detected wild write in arena %p\n", file, line, (void *)arena);
+                if ((char *)buffer_ptr + sizeof(m61_overflow_buffer) <= chunk->top)
+                {
+                    fprintf(stderr, "  %s:%u: after %u byte object %p allocated here\n",
+                            object->file, object->line, object->size, payload);
+                }
+                abort();
+            }
+            p = (char *)(((uintptr_t)(buffer_ptr + 1) + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1));
+        }
+    }
+}
+
+// release every chunk of `arena` older than `keep` and drop its objects
+// from the statistics
+static void release_arena_chunks(m61_arena *arena, m61_arena_chunk *keep)
+{
+    m61_stats_shard *shard = m61_shard();
+    m61_arena_chunk *chunk = arena->chunks;
+    while (chunk != keep)
+    {
+        m61_arena_chunk *next = chunk->next;
+        size_t sz = chunk->end - (char *)chunk;
+        arena->chunk_size -= sz;
+        SHARD_ADD(shard, arena_chunk_size, -(unsigned long long)sz);
+        base_free(chunk);
+        note_reserved(-(long long)sz);
+        chunk = next;
+    }
+    arena->chunks = keep;
+    if (keep)
+    {
+        keep->top = (char *)(keep + 1);
+    }
+    SHARD_ADD(shard, arena_nobjects, -arena->nobjects);
+    SHARD_ADD(shard, arena_size, -arena->size);
+    arena->nobjects = 0;
+    arena->size = 0;
+}
+
+/// m61_arena_create(flags, file, line)
+///    Return a new, empty arena, or NULL if out of memory. If `flags`
+///    includes M61_ARENA_CANARY, every object gets a canary that is checked
+///    when the arena is reset or destroyed. The arena was created at
+///    location `file`:`line`, which the leak report names if it is never
+///    destroyed.
+
+m61_arena *m61_arena_create(int flags, const char *file, int line)
+{
+    m61_stats_shard *shard = m61_shard();
+    m61_arena *arena = base_malloc(sizeof(m61_arena));
+    if (!arena)
+    {
+        SHARD_ADD(shard, nfail, 1);
+        SHARD_ADD(shard, fail_size, sizeof(m61_arena));
+        return NULL;
+    }
+    memset(arena, 0, sizeof(m61_arena));
+    arena->magic = ARENA_MAGIC;
+    arena->file = file;
+    arena->line = line;
+    arena->flags = flags;
+
+    pthread_mutex_lock(&arenas_lock);
+    arena->next = live_arenas;
+    if (live_arenas)
+    {
+        live_arenas->prev = arena;
+    }
+    live_arenas = arena;
+    pthread_mutex_unlock(&arenas_lock);
+
+    SHARD_ADD(shard, narenas, 1);
+    SHARD_ADD(shard, arena_ntotal, 1);
+    return arena;
+}
+
+/// m61_arena_alloc(arena, sz, file, line)
+///    Return a pointer to `sz` bytes of memory from `arena`, or NULL if out
+///    of memory. The memory lasts until the arena is reset or destroyed
+///    and must not be passed to m61_free. The allocation request was at
+///    location `file`:`line`.
+
+void *m61_arena_alloc(m61_arena *arena, size_t sz, const char *file, int line)
+{
+    check_arena(arena, file, line);
+    m61_stats_shard *shard = m61_shard();
+    if (sz > M61_SIZE_LIMIT)
+    {
+        SHARD_ADD(shard, nfail, 1);
+        SHARD_ADD(shard, fail_size, sz);
+        return NULL;
+    }
+    // every object takes at least one aligned unit, so pointers are unique
+    size_t need = sz ? sz : 1;
+    if (arena->flags & M61_ARENA_CANARY)
+    {
+        need += sizeof(m61_arena_object) + sizeof(m61_overflow_buffer);
+    }
+    need = (need + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    m61_arena_chunk *chunk = arena->chunks;
+    if (!chunk || (size_t)(chunk->end - chunk->top) < need)
+    {
+        size_t chunk_sz = sizeof(m61_arena_chunk) + need;
+        if (chunk_sz < ARENA_CHUNK_SIZE)
+        {
+            chunk_sz = ARENA_CHUNK_SIZE;
+        }
+        chunk = base_malloc(chunk_sz);
+        if (!chunk)
+        {
+            SHARD_ADD(shard, nfail, 1);
+            SHARD_ADD(shard, fail_size, sz);
+            return NULL;
+        }
+        chunk->top = (char *)(chunk + 1);
+        chunk->end = (char *)chunk + chunk_sz;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->chunk_size += chunk_sz;
+        SHARD_ADD(shard, arena_chunk_size, chunk_sz);
+        note_reserved(chunk_sz);
+        update_heap_bounds((char *)chunk, chunk->end);
+    }
+
+    char *payload = chunk->top;
+    if (arena->flags & M61_ARENA_CANARY)
+    {
+        m61_arena_object *object = (m61_arena_object *)payload;
+        object->file = file;
+        object->line = line;
+        object->size = sz;
+        payload = (char *)(object + 1);
+        m61_overflow_buffer buffer = {1111};
+        memcpy(payload + sz, &buffer, sizeof(buffer));
+    }
+    chunk->top += need;
+    ++arena->nobjects;
+    arena->size += sz;
+    SHARD_ADD(shard, arena_nobjects, 1);
+    SHARD_ADD(shard, arena_size, sz);
+    return payload;
+}
+
+/// m61_arena_reset(arena, file, line)
+///    Release every object in `arena` at once, keeping its first chunk for
+///    reuse. The reset was called at location `file`:`line`.
+
+void m61_arena_reset(m61_arena *arena, const char *file, int line)
+{
+    check_arena(arena, file, line);
+    check_arena_canaries(arena, file, line);
+    m61_arena_chunk *oldest = arena->chunks;
+    while (oldest && oldest->next)
+    {
+        oldest = oldest->next;
+    }
+    release_arena_chunks(arena, oldest);
+}
+
+/// m61_arena_destroy(arena, file, line)
+///    Release every object in `arena` and the arena itself. NULL is
+///    ignored. The destroy was called at location `file`:`line`.
+
+void m61_arena_destroy(m61_arena *arena, const char *file, int line)
+{
+    if (!arena)
+    {
+        return;
+    }
+    check_arena(arena, file, line);
+    check_arena_canaries(arena, file, line);
+    release_arena_chunks(arena, NULL);
+
+    pthread_mutex_lock(&arenas_lock);
+    if (arena->prev)
+    {
+        arena->prev->next = arena->next;
+    }
+    else
+    {
+        live_arenas = arena->next;
+    }
+    if (arena->next)
+    {
+        arena->next->prev = arena->prev;
+    }
+    pthread_mutex_unlock(&arenas_lock);
+
+    arena->magic = 0;
+    SHARD_ADD(m61_shard(), narenas, -1);
+    base_free(arena);
+}
+
+/// m61_getstatistics(stats)
+///    Store the current memory statistics in `*stats`.
+
+void m61_getstatistics(struct m61_statistics *stats)
+{
+    // clean stats
+    // then sum every thread's shard
+    memset(stats, 0, sizeof(struct m61_statistics));
+    for (m61_stats_shard *shard = __atomic_load_n(&all_shards, __ATOMIC_ACQUIRE);
+         shard != NULL; shard = shard->next)
+    {
+        stats->nactive += __atomic_load_n(&shard->stats.nactive, __ATOMIC_RELAXED);
+        stats->active_size += __atomic_load_n(&shard->stats.active_size, __ATOMIC_RELAXED);
+        stats->ntotal += __atomic_load_n(&shard->stats.ntotal, __ATOMIC_RELAXED);
+        stats->total_size += __atomic_load_n(&shard->stats.total_size, __ATOMIC_RELAXED);
+        stats->nfail += __atomic_load_n(&shard->stats.nfail, __ATOMIC_RELAXED);
+        stats->fail_size += __atomic_load_n(&shard->stats.fail_size, __ATOMIC_RELAXED);
+        stats->narenas += __atomic_load_n(&shard->stats.narenas, __ATOMIC_RELAXED);
+        stats->arena_ntotal += __atomic_load_n(&shard->stats.arena_ntotal, __ATOMIC_RELAXED);
+        stats->arena_nobjects += __atomic_load_n(&shard->stats.arena_nobjects, __ATOMIC_RELAXED);
+        stats->arena_size += __atomic_load_n(&shard->stats.arena_size, __ATOMIC_RELAXED);
+        stats->arena_chunk_size += __atomic_load_n(&shard->stats.arena_chunk_size, __ATOMIC_RELAXED);
+    }
+    stats->heap_min = __atomic_load_n(&heap_min, __ATOMIC_RELAXED);
+    stats->heap_max = __atomic_load_n(&heap_max, __ATOMIC_RELAXED);
+}
+
+/// m61_printstatistics()
+///    Print the current memory statistics.
+
+void m61_printstatistics(void)
+{
+    struct m61_statistics stats;
+    m61_getstatistics(&stats);
+
+    printf("malloc count: active %10llu   total %10llu   fail %10llu\n",
+           stats.nactive, stats.ntotal, stats.nfail);
+    printf("malloc size:  active %10llu   total %10llu   fail %10llu\n",
+           stats.active_size, stats.total_size, stats.fail_size);
+    // programs that never use arenas see the classic report
+    if (stats.arena_ntotal)
+    {
+        printf("arena count:  active %10llu   total %10llu   objects %7llu\n",
+               stats.narenas, stats.arena_ntotal, stats.arena_nobjects);
+        printf("arena size:   objects %9llu   chunks %9llu\n",
+               stats.arena_size, stats.arena_chunk_size);
+    }
+}
+
+// leak report modes: one line per block, or one line per call site
+static int leak_report_mode = M61_LEAK_BLOCKS;
+
+// one call site in the aggregated leak report
+typedef struct m61_leak_site
+{
+    const char *file; // NULL if the slot is empty
+    int line;
+    unsigned stack;           // stack id, in M61_LEAK_STACKS mode
+    unsigned long long count; // # leaked blocks
+    unsigned long long bytes; // # leaked bytes
+    char *sample;             // one leaked payload
+} m61_leak_site;
+
+// open-addressing table from file:line to leak totals, grown by doubling
+typedef struct m61_leak_table
+{
+    m61_leak_site *slots;
+    size_t capacity; // power of two
+    size_t nsites;
+    int failed;      // out of memory
+} m61_leak_table;
+
+// find the slot for file:line and stack `stack` in `slots`
+static m61_leak_site *leak_slot(m61_leak_site *slots, size_t capacity, const char *file, int line, unsigned stack)
+{
+    size_t i = (hash_site(file, line) ^ stack * 0x9E3779B97F4A7C15ULL) & (capacity - 1);
+    while (slots[i].file && (slots[i].file != file || slots[i].line != line || slots[i].stack != stack))
+    {
+        i = (i + 1) & (capacity - 1);
+    }
+    return &slots[i];
+}
+
+// double the table; return 0 on success
+static int leak_table_grow(m61_leak_table *t)
+{
+    size_t capacity = t->capacity ? 2 * t->capacity : 1024;
+    m61_leak_site *slots = base_malloc(capacity * sizeof(m61_leak_site));
+    if (!slots)
+    {
+        return -1;
+    }
+    memset(slots, 0, capacity * sizeof(m61_leak_site));
+    for (size_t i = 0; i < t->capacity; ++i)
+    {
+        if (t->slots[i].file)
+        {
+            *leak_slot(slots, capacity, t->slots[i].file, t->slots[i].line, t->slots[i].stack) = t->slots[i];
+        }
+    }
+    base_free(t->slots);
+    t->slots = slots;
+    t->capacity = capacity;
+    return 0;
+}
+
+// add one leaked block found in the live map to its site
+static void count_leak(char *payload, void *arg)
+{
+    m61_leak_table *t = arg;
+    if (t->failed || (2 * (t->nsites + 1) > t->capacity && leak_table_grow(t) != 0))
+    {
+        t->failed = 1;
+        return;
+    }
+    struct m61_metadata *metadata = (struct m61_metadata *)payload - 1;
+    const char *file = metadata_file(metadata);
+    int line = metadata_line(metadata);
+    unsigned stack = leak_report_mode == M61_LEAK_STACKS ? metadata_stack(metadata) : 0;
+    m61_leak_site *site = leak_slot(t->slots, t->capacity, file, line, stack);
+    if (!site->file)
+    {
+        site->file = file;
+        site->line = line;
+        site->stack = stack;
+        site->sample = payload;
+        ++t->nsites;
+    }
+    ++site->count;
+    site->bytes += metadata->size;
+}
+
+static int compare_leak_sites(const void *a, const void *b)
+{
+    const m61_leak_site *x = a, *y = b;
+    if (x->bytes != y->bytes)
+    {
+        return x->bytes < y->bytes ? 1 : -1;
+    }
+    return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+// print leaked blocks grouped by call site (and by backtrace in
+// M61_LEAK_STACKS mode), most bytes first
+static void print_leaks_by_site(void)
+{
+    m61_leak_table t = {NULL, 0, 0, 0};
+    livemap_foreach(count_leak, &t);
+    if (t.failed)
+    {
+        fprintf(stderr, "m61: out of memory for the leak report\n");
+        base_free(t.slots);
+        return;
+    }
+    // pack the sites to the front of the table and sort them
+    size_t n = 0;
+    unsigned long long count = 0, bytes = 0;
+    for (size_t i = 0; i < t.capacity; ++i)
+    {
+        if (t.slots[i].file)
+        {
+            count += t.slots[i].count;
+            bytes += t.slots[i].bytes;
+            t.slots[n++] = t.slots[i];
+        }
+    }
+    qsort(t.slots, n, sizeof(m61_leak_site), compare_leak_sites);
+    for (size_t i = 0; i < n; ++i)
+    {
+        printf("LEAK CHECK: %s:%d: %llu allocated objects with total size %llu, e.g. %p\n",
+               t.slots[i].file, t.slots[i].line, t.slots[i].count, t.slots[i].bytes, t.slots[i].sample);
+        if (t.slots[i].stack)
+        {
+            print_stack(t.slots[i].stack);
+        }
+    }
+    if (n)
+    {
+        printf("LEAK CHECK: %llu objects with total size %llu leaked from %zu %s\n", count, bytes, n,
+               leak_report_mode == M61_LEAK_STACKS ? "stacks" : "sites");
+    }
+    base_free(t.slots);
+}
+
+/// m61_set_leak_report(mode)
+///    Choose what m61_printleakreport prints: M61_LEAK_BLOCKS (the
+///    default), M61_LEAK_SITES or M61_LEAK_STACKS.
+
+void m61_set_leak_report(int mode)
+{
+    leak_report_mode = mode;
+}
+
+// read the leak report mode from M61_LEAK_REPORT ("blocks", "sites" or
+// "stacks")
+__attribute__((constructor)) static void m61_leak_report_init(void)
+{
+    const char *mode = getenv("M61_LEAK_REPORT");
+    if (mode && strcmp(mode, "sites") == 0)
+    {
+        m61_set_leak_report(M61_LEAK_SITES);
+    }
+    else if (mode && strcmp(mode, "stacks") == 0)
+    {
+        m61_set_leak_report(M61_LEAK_STACKS);
+    }
+    else if (mode && strcmp(mode, "blocks") == 0)
+    {
+        m61_set_leak_report(M61_LEAK_BLOCKS);
+    }
+}
+
+/// m61_printleakreport()
+///    Print a report of all currently-active allocated blocks of dynamic
+///    memory, one line per block or, in M61_LEAK_SITES mode, one line per
+///    call site sorted by bytes, then of every arena that has not been
+///    destroyed.
+
+#if M61_COMPACT
+// print one leaked block found in the live map
+static void print_leak(char *payload, void *arg)
+{
+    (void)arg;
+    struct m61_metadata *metadata = (struct m61_metadata *)payload - 1;
+    printf("LEAK CHECK: %s:%d: allocated object %p with size %llu\n", metadata_file(metadata), metadata_line(metadata), payload, (unsigned long long)metadata->size);
+}
+#endif
+
+void m61_printleakreport(void)
+{
+    if (!M61_TRACKING)
+    {
+        // blocks are not tracked
+    }
+    else if (leak_report_mode == M61_LEAK_SITES || leak_report_mode == M61_LEAK_STACKS)
+    {
+        print_leaks_by_site();
+    }
+    else
+    {
+#if M61_COMPACT
+        livemap_foreach(print_leak, NULL);
+#else
+        for (int i = 0; i < M61_STRIPES; ++i)
+        {
+            pthread_mutex_lock(&active_stripes[i].lock);
+            for (struct m61_metadata *metadata = active_stripes[i].head; metadata != NULL; metadata = metadata->next)
+            {
+                printf("LEAK CHECK: %s:%d: allocated object %p with size %llu\n", metadata_file(metadata), metadata_line(metadata), metadata->ptr_addr, metadata->size);
+            }
+            pthread_mutex_unlock(&active_stripes[i].lock);
+        }
+#endif
+    }
+    // objects in arenas are reported by arena
+    pthread_mutex_lock(&arenas_lock);
+    for (m61_arena *arena = live_arenas; arena != NULL; arena = arena->next)
+    {
+        printf("LEAK CHECK: %s:%d: allocated arena %p with %llu objects of size %llu\n", arena->file, arena->line, (void *)arena, arena->nobjects, arena->size);
+    }
+    pthread_mutex_unlock(&arenas_lock);
+}
+
+/// m61_fragmentation_report()
+///    Print how the memory m61 holds is used: live payload against block
+///    overhead and against the bytes reserved from base_malloc, a size
+///    class histogram of live blocks, and the largest extents of free
+///    memory m61 holds. Other threads should not be allocating.
+
+#define FRAG_NBUCKETS (SLAB_NCLASSES + 64) // slab classes, then powers of 2
+#define FRAG_NGAPS 5
+
+typedef struct m61_frag_bucket
+{
+    unsigned long long count;   // # live blocks
+    unsigned long long payload; // # payload bytes in them
+    unsigned long long total;   // # bytes in whole blocks
+} m61_frag_bucket;
+
+typedef struct m61_frag_walk
+{
+    m61_frag_bucket buckets[FRAG_NBUCKETS];
+    unsigned long long count, payload, total, slack;
+} m61_frag_walk;
+
+// free extents
+// the address space between two live blocks is often not m61's at all
+// (it may lie between the heap and a mapped block, or hold the C
+// library's own data), so the report lists only memory m61 holds free:
+// quarantined blocks, thread-cached blocks, slab free lists and the
+// base allocator's free blocks. Extents that touch are merged, so a slab
+// page with neighbouring free slots shows as one run.
+typedef struct m61_frag_extent
+{
+    char *start;
+    size_t size;
+} m61_frag_extent;
+
+typedef struct m61_frag_extents
+{
+    m61_frag_extent *v; // mmapped, so collecting never calls base_malloc
+    size_t n, capacity;
+    int failed;         // out of memory: the list is incomplete
+} m61_frag_extents;
+
+// the histogram bucket of a block of `total` bytes
+static int frag_bucket(size_t total)
+{
+    if (total <= SLAB_MAXSIZE)
+    {
+        return slab_class_index(total);
+    }
+    return SLAB_NCLASSES + 63 - __builtin_clzll(total - 1);
+}
+
+// smallest and largest block size in a histogram bucket
+static void frag_bucket_range(int b, size_t *lo, size_t *hi)
+{
+    if (b < SLAB_NCLASSES)
+    {
+        *lo = b ? slab_class_size[b - 1] + 1 : 1;
+        *hi = slab_class_size[b];
+    }
+    else
+    {
+        *lo = ((size_t)1 << (b - SLAB_NCLASSES)) + 1;
+        *hi = (size_t)1 << (b - SLAB_NCLASSES + 1);
+    }
+}
+
+// add one live block to the walk
+static void frag_visit(char *payload, void *arg)
+{
+    m61_frag_walk *walk = arg;
+    struct m61_metadata *metadata = (struct m61_metadata *)payload - 1;
+    size_t total = block_total(metadata);
+    m61_frag_bucket *bucket = &walk->buckets[frag_bucket(total)];
+    ++bucket->count;
+    bucket->payload += metadata->size;
+    bucket->total += total;
+    ++walk->count;
+    walk->payload += metadata->size;
+    walk->total += total;
+    walk->slack += metadata->slack;
+}
+
+// add a free extent to the list
+static void frag_add_extent(void *ptr, size_t size, void *arg)
+{
+    m61_frag_extents *ex = arg;
+    if (ex->n == ex->capacity)
+    {
+        size_t capacity = ex->capacity ? 2 * ex->capacity : 1024;
+        m61_frag_extent *v = mmap(NULL, capacity * sizeof(m61_frag_extent), PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (v == MAP_FAILED)
+        {
+            ex->failed = 1;
+            return;
+        }
+        if (ex->v)
+        {
+            memcpy(v, ex->v, ex->n * sizeof(m61_frag_extent));
+            munmap(ex->v, ex->capacity * sizeof(m61_frag_extent));
+        }
+        ex->v = v;
+        ex->capacity = capacity;
+    }
+    ex->v[ex->n].start = ptr;
+    ex->v[ex->n].size = size;
+    ++ex->n;
+}
+
+static int compare_frag_extents(const void *a, const void *b)
+{
+    const m61_frag_extent *x = a, *y = b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+// collect every free extent m61 holds
+static void frag_collect_extents(m61_frag_extents *ex)
+{
+    for (m61_stats_shard *shard = __atomic_load_n(&all_shards, __ATOMIC_ACQUIRE);
+         shard != NULL; shard = shard->next)
+    {
+        m61_quarantine *q = shard->quarantine;
+        for (size_t i = 0; q && i < q->count; ++i)
+        {
+            m61_quarantine_entry *e = &q->ring[(q->head + i) % QUARANTINE_CAPACITY];
+            frag_add_extent(e->block, e->total, ex);
+        }
+        for (int c = 0; shard->tcache && c < SLAB_NCLASSES; ++c)
+        {
+            for (char *block = shard->tcache->head[c]; block; block = (char *)slab_link(block)->next)
+            {
+                frag_add_extent(block, slab_class_size[c], ex);
+            }
+        }
+    }
+    for (int c = 0; M61_SLAB && c < SLAB_NCLASSES; ++c)
+    {
+        slab_class *sc = &slab_classes[c];
+        pthread_mutex_lock(&sc->lock);
+        for (char *block = sc->free_head; block; block = (char *)slab_link(block)->next)
+        {
+            frag_add_extent(block, slab_class_size[c], ex);
+        }
+        pthread_mutex_unlock(&sc->lock);
+    }
+    base_malloc_foreach_free(frag_add_extent, ex);
+}
+
+// merge touching extents in the list and keep the FRAG_NGAPS largest,
+// largest first, in gap and gap_size
+static void frag_largest_extents(m61_frag_extents *ex, char **gap, size_t *gap_size)
+{
+    qsort(ex->v, ex->n, sizeof(m61_frag_extent), compare_frag_extents);
+    size_t i = 0;
+    while (i < ex->n)
+    {
+        char *start = ex->v[i].start;
+        size_t size = ex->v[i].size;
+        for (++i; i < ex->n && ex->v[i].start == start + size; ++i)
+        {
+            size += ex->v[i].size;
+        }
+        int j = FRAG_NGAPS;
+        while (j > 0 && gap_size[j - 1] < size)
+        {
+            if (j < FRAG_NGAPS)
+            {
+                gap[j] = gap[j - 1];
+                gap_size[j] = gap_size[j - 1];
+            }
+            --j;
+        }
+        if (j < FRAG_NGAPS)
+        {
+            gap[j] = start;
+            gap_size[j] = size;
+        }
+    }
+}
+
+static double percent(unsigned long long part, unsigned long long whole)
+{
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+void m61_fragmentation_report(void)
+{
+    static m61_frag_walk walk;
+    memset(&walk, 0, sizeof(walk));
+    livemap_foreach(frag_visit, &walk);
+
+    // memory held from base_malloc, and the free blocks m61 is holding on to
+    unsigned long long reserved = 0, quarantined = 0, cached = 0;
+    for (m61_stats_shard *shard = __atomic_load_n(&all_shards, __ATOMIC_ACQUIRE);
+         shard != NULL; shard = shard->next)
+    {
+        reserved += __atomic_load_n(&shard->reserved, __ATOMIC_RELAXED);
+        if (shard->quarantine)
+        {
+            quarantined += shard->quarantine->bytes;
+        }
+        for (int c = 0; shard->tcache && c < SLAB_NCLASSES; ++c)
+        {
+            cached += (unsigned long long)shard->tcache->count[c] * slab_class_size[c];
+        }
+    }
+    struct m61_statistics stats;
+    m61_getstatistics(&stats);
+    unsigned long long arena_chunks = stats.arena_chunk_size;
+    unsigned long long used = walk.total + quarantined + cached + arena_chunks;
+    unsigned long long header = walk.count * sizeof(struct m61_metadata);
+    unsigned long long canary = walk.count * sizeof(m61_overflow_buffer);
+
+    printf("FRAGMENTATION: %llu live blocks, %llu payload bytes in %llu block bytes\n",
+           walk.count, walk.payload, walk.total);
+    printf("  overhead: %llu header + %llu canary + %llu slack = %llu bytes (%.1f%% of block bytes)\n",
+           header, canary, walk.slack, header + canary + walk.slack,
+           percent(header + canary + walk.slack, walk.total));
+    printf("  reserved: %llu bytes; live blocks %llu, quarantined %llu, cached %llu, arenas %llu, free %llu\n",
+           reserved, walk.total, quarantined, cached, arena_chunks,
+           reserved > used ? reserved - used : 0);
+    printf("  utilization %.1f%% (payload / reserved), external fragmentation %.1f%% (free / reserved)\n",
+           percent(walk.payload, reserved),
+           percent(reserved > used ? reserved - used : 0, reserved));
+    if (stats.heap_min && stats.heap_max > stats.heap_min)
+    {
+        unsigned long long span = stats.heap_max - stats.heap_min;
+        printf("  heap span: %llu bytes, %.1f%% covered by live blocks\n",
+               span, percent(walk.total, span));
+    }
+
+    printf("  live blocks by size:\n");
+    for (int b = 0; b < FRAG_NBUCKETS; ++b)
+    {
+        m61_frag_bucket *bucket = &walk.buckets[b];
+        if (bucket->count)
+        {
+            size_t lo, hi;
+            frag_bucket_range(b, &lo, &hi);
+            printf("    %8zu-%-8zu %10llu blocks %14llu payload %14llu total (%.1f%% overhead)\n",
+                   lo, hi, bucket->count, bucket->payload, bucket->total,
+                   percent(bucket->total - bucket->payload, bucket->total));
+        }
+    }
+
+    m61_frag_extents ex = {NULL, 0, 0, 0};
+    char *gap[FRAG_NGAPS] = {NULL};
+    size_t gap_size[FRAG_NGAPS] = {0};
+    frag_collect_extents(&ex);
+    frag_largest_extents(&ex, gap, gap_size);
+    if (ex.v)
+    {
+        munmap(ex.v, ex.capacity * sizeof(m61_frag_extent));
+    }
+    printf("  largest free extents%s:\n", ex.failed ? " (incomplete)" : "");
+    for (int i = 0; i < FRAG_NGAPS && gap_size[i]; ++i)
+    {
+        printf("    %p: %zu bytes\n", gap[i], gap_size[i]);
+    }
+}
+
+/// m61_print_lifetime_report()
+///    Print the call sites with the most sampled bytes freed within 1 ms,
+///    where an arena or pool would pay off, then the sites with the most
+///    bytes that lived 1 s or more or are still live, each with a log2
+///    histogram of lifetimes. Counts and bytes are estimates scaled up from
+///    the samples.
+
+#define LIFETIME_NREPORT 10
+
+typedef struct m61_lifetime_summary
+{
+    unsigned site;
+    unsigned long long count, bytes;             // freed and still live
+    unsigned long long short_count, short_bytes; // freed within 1 ms
+    unsigned long long long_count, long_bytes;   // lived 1 s or still live
+    unsigned long long live_count;               // still live
+} m61_lifetime_summary;
+
+static int compare_short_lived(const void *a, const void *b)
+{
+    const m61_lifetime_summary *x = a, *y = b;
+    return x->short_bytes < y->short_bytes ? 1 : x->short_bytes > y->short_bytes ? -1 : 0;
+}
+
+static int compare_long_lived(const void *a, const void *b)
+{
+    const m61_lifetime_summary *x = a, *y = b;
+    return x->long_bytes < y->long_bytes ? 1 : x->long_bytes > y->long_bytes ? -1 : 0;
+}
+
+// print a duration of `ns` nanoseconds in a readable unit
+static void print_duration(double ns)
+{
+    if (ns < 1000)
+    {
+        printf("%.0fns", ns);
+    }
+    else if (ns < 1000000)
+    {
+        printf("%.3gus", ns / 1000);
+    }
+    else if (ns < 1000000000)
+    {
+        printf("%.3gms", ns / 1000000);
+    }
+    else
+    {
+        printf("%.3gs", ns / 1000000000);
+    }
+}
+
+// print one site's histogram as "<upper bound:count" for nonempty bins
+static void print_lifetimes(unsigned site, double ns_per_tick)
+{
+    m61_lifetime_site *ls = lifetime_sites[site];
+    printf("    lifetimes:");
+    for (int b = 0; ls && b < LIFETIME_NBINS; ++b)
+    {
+        if (ls->count[b])
+        {
+            printf(" <");
+            print_duration(ldexp(1, b) * ns_per_tick);
+            printf(":%llu", ls->count[b]);
+        }
+    }
+    printf("\n");
+}
+
+void m61_print_lifetime_report(void)
+{
+    pthread_mutex_lock(&lifetime_lock);
+    // ticks per ns, measured since the first sample
+    uint64_t now = trace_time();
+    struct timespec now_time;
+    clock_gettime(CLOCK_MONOTONIC, &now_time);
+    double elapsed_ns = (now_time.tv_sec - lifetime_start_time.tv_sec) * 1e9 + (now_time.tv_nsec - lifetime_start_time.tv_nsec);
+    double ns_per_tick = now > lifetime_start_ticks && elapsed_ns > 0 ? elapsed_ns / (now - lifetime_start_ticks) : 1;
+
+    m61_lifetime_summary *sums = base_malloc(M61_MAXSITES * sizeof(m61_lifetime_summary));
+    if (!sums)
+    {
+        pthread_mutex_unlock(&lifetime_lock);
+        return;
+    }
+    memset(sums, 0, M61_MAXSITES * sizeof(m61_lifetime_summary));
+    for (unsigned site = 0; site < M61_MAXSITES; ++site)
+    {
+        m61_lifetime_summary *sum = &sums[site];
+        sum->site = site;
+        m61_lifetime_site *ls = lifetime_sites[site];
+        for (int b = 0; ls && b < LIFETIME_NBINS; ++b)
+        {
+            sum->count += ls->count[b];
+            sum->bytes += ls->bytes[b];
+            // bin b holds lifetimes in [2^(b-1), 2^b) ticks
+            if (ldexp(1, b) * ns_per_tick <= LIFETIME_SHORT_NS)
+            {
+                sum->short_count += ls->count[b];
+                sum->short_bytes += ls->bytes[b];
+            }
+            else if (b > 0 && ldexp(1, b - 1) * ns_per_tick >= LIFETIME_LONG_NS)
+            {
+                sum->long_count += ls->count[b];
+                sum->long_bytes += ls->bytes[b];
+            }
+        }
+    }
+    // blocks still live count as long-lived
+    for (size_t i = 0; lifetime_table && i < LIFETIME_TABLE_SIZE; ++i)
+    {
+        if (lifetime_table[i].payload)
+        {
+            struct m61_metadata *metadata = (struct m61_metadata *)lifetime_table[i].payload - 1;
+            m61_lifetime_summary *sum = &sums[metadata_site(metadata)];
+            uint64_t weight = lifetime_table[i].weight;
+            sum->count += weight;
+            sum->bytes += weight * metadata->size;
+            sum->long_count += weight;
+            sum->long_bytes += weight * metadata->size;
+            sum->live_count += weight;
+        }
+    }
+
+    printf("LIFETIME REPORT: %llu sampled allocations, about 1 in %zu\n",
+           lifetime_nsamples, __atomic_load_n(&m61_lifetime_rate, __ATOMIC_RELAXED));
+    printf("short-lived sites (most bytes freed within 1 ms):\n");
+    qsort(sums, M61_MAXSITES, sizeof(m61_lifetime_summary), compare_short_lived);
+    for (int i = 0; i < LIFETIME_NREPORT && sums[i].short_bytes; ++i)
+    {
+        m61_lifetime_summary *sum = &sums[i];
+        printf("  %s:%d: %llu of %llu bytes short-lived (%.0f%%), %llu of %llu objects\n",
+               m61_sites[sum->site].file, m61_sites[sum->site].line,
+               sum->short_bytes, sum->bytes, 100.0 * sum->short_bytes / sum->bytes,
+               sum->short_count, sum->count);
+        print_lifetimes(sum->site, ns_per_tick);
+    }
+    printf("long-lived sites (most bytes live 1 s or more, or still live):\n");
+    qsort(sums, M61_MAXSITES, sizeof(m61_lifetime_summary), compare_long_lived);
+    for (int i = 0; i < LIFETIME_NREPORT && sums[i].long_bytes; ++i)
+    {
+        m61_lifetime_summary *sum = &sums[i];
+        printf("  %s:%d: %llu of %llu bytes long-lived (%.0f%%), %llu of %llu objects, %llu still live\n",
+               m61_sites[sum->site].file, m61_sites[sum->site].line,
+               sum->long_bytes, sum->bytes, 100.0 * sum->long_bytes / sum->bytes,
+               sum->long_count, sum->count, sum->live_count);
+        print_lifetimes(sum->site, ns_per_tick);
+    }
+    pthread_mutex_unlock(&lifetime_lock);
+    base_free(sums);
+}
+
+// prints heavy hitter report
+// if total bytes of line > %10 print stats
+void m61_heavyHitterTest(void)
+{
+    // at most 9 sites can each hold more than 10% of the bytes
+    struct m61_heavyhitter hh[10];
+    unsigned long long total;
+    size_t n = heavyhitters_snapshot(hh, 10, &total);
+    for (size_t i = 0; i < n; ++i)
+    {
+        // if allocated bytes of file-line is greater than 10% of total
+        // bytes being used
+        if ((float)hh[i].size / (float)total > .10)
+        {
+            printf("HEAVY HITTER: %s:%i: %llu bytes, (~%.1f)\n",
+                   hh[i].file, hh[i].line, hh[i].size,
+                   (float)hh[i].size / (float)total * 100);
+        }
+    }
+
+    // with stack sampling on, also report backtraces over 10% of the
+    // sampled bytes
+    unsigned nstacks = __atomic_load_n(&m61_nstacks, __ATOMIC_ACQUIRE);
+    unsigned long long stack_bytes = 0;
+    for (unsigned id = 1; id < nstacks; ++id)
+    {
+        stack_bytes += __atomic_load_n(&m61_stacks[id].bytes, __ATOMIC_RELAXED);
+    }
+    for (unsigned id = 1; id < nstacks; ++id)
+    {
+        unsigned long long bytes = __atomic_load_n(&m61_stacks[id].bytes, __ATOMIC_RELAXED);
+        if ((float)bytes / (float)stack_bytes > .10)
+        {
+            printf("HEAVY HITTER STACK: %llu bytes, (~%.1f)\n",
+                   bytes, (float)bytes / (float)stack_bytes * 100);
+            print_stack(id);
+        }
+    }
+}
+
+// shared-memory statistics export
+// m61_shm_start creates the POSIX shared memory object "/m61.PID" and
+// starts a thread that copies the statistics and the top heavy hitters
+// into it every interval. Allocating threads never touch the segment.
+// Updates follow a sequence lock: the publisher makes `seq` odd before
+// writing and even again after, and a reader that sees an odd or changed
+// `seq` simply copies again, so neither side ever waits for the other.
+static struct m61_shm *shm_segment = NULL;
+static char shm_name[32];
+static pthread_t shm_thread;
+static int shm_running = 0;
+static unsigned shm_interval_ms = 0;
+static pthread_mutex_t shm_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t shm_cond = PTHREAD_COND_INITIALIZER;
+
+// copy the current statistics and heavy hitters into `seg`
+static void shm_publish(struct m61_shm *seg)
+{
+    struct m61_statistics stats;
+    struct m61_heavyhitter hh[M61_SHM_NSITES];
+    m61_getstatistics(&stats);
+    size_t n = m61_getheavyhitters(hh, M61_SHM_NSITES);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // only this thread writes `seq`
+    unsigned long long seq = seg->seq;
+    __atomic_store_n(&seg->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    seg->time_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    seg->stats = stats;
+    seg->nsites = n;
+    for (size_t i = 0; i < n; ++i)
+    {
+        snprintf(seg->sites[i].file, sizeof(seg->sites[i].file), "%s", hh[i].file);
+        seg->sites[i].line = hh[i].line;
+        seg->sites[i].count = hh[i].count;
+        seg->sites[i].size = hh[i].size;
+    }
+    __atomic_store_n(&seg->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// publish every shm_interval_ms until m61_shm_stop
+static void *shm_main(void *arg)
+{
+    struct m61_shm *seg = arg;
+    pthread_mutex_lock(&shm_lock);
+    while (shm_running)
+    {
+        pthread_mutex_unlock(&shm_lock);
+        shm_publish(seg);
+        pthread_mutex_lock(&shm_lock);
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += shm_interval_ms / 1000;
+        until.tv_nsec += (shm_interval_ms % 1000) * 1000000L;
+        if (until.tv_nsec >= 1000000000L)
+        {
+            ++until.tv_sec;
+            until.tv_nsec -= 1000000000L;
+        }
+        while (shm_running && pthread_cond_timedwait(&shm_cond, &shm_lock, &until) == 0)
+        {
+        }
+    }
+    pthread_mutex_unlock(&shm_lock);
+    return NULL;
+}
+
+/// m61_shm_stop()
+///    Stop publishing statistics and remove the shared memory object.
+///    Runs automatically at exit.
+
+void m61_shm_stop(void)
+{
+    pthread_mutex_lock(&shm_lock);
+    if (!shm_running)
+    {
+        pthread_mutex_unlock(&shm_lock);
+        return;
+    }
+    shm_running = 0;
+    pthread_cond_signal(&shm_cond);
+    pthread_mutex_unlock(&shm_lock);
+    pthread_join(shm_thread, NULL);
+    munmap(shm_segment, sizeof(struct m61_shm));
+    shm_segment = NULL;
+    shm_unlink(shm_name);
+}
+
+/// m61_shm_start(interval_ms)
+///    Publish the statistics and top heavy hitters in the shared memory
+///    object "/m61.PID" every `interval_ms` milliseconds, from a thread of
+///    its own, replacing any export in progress. Returns 0 on success, -1
+///    if the object cannot be created.
+
+int m61_shm_start(unsigned interval_ms)
+{
+    static int registered = 0;
+    m61_shm_stop();
+    snprintf(shm_name, sizeof(shm_name), "/m61.%ld", (long)getpid());
+    int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    struct m61_shm *seg = MAP_FAILED;
+    if (ftruncate(fd, sizeof(struct m61_shm)) == 0)
+    {
+        seg = mmap(NULL, sizeof(struct m61_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (seg == MAP_FAILED)
+    {
+        shm_unlink(shm_name);
+        return -1;
+    }
+    // the new object is zero-filled, so `seq` starts even
+    memcpy(seg->magic, M61_SHM_MAGIC, sizeof(seg->magic));
+    seg->pid = getpid();
+    seg->interval_ms = interval_ms ? interval_ms : 1;
+    shm_publish(seg);
+
+    shm_segment = seg;
+    shm_interval_ms = seg->interval_ms;
+    shm_running = 1;
+    if (pthread_create(&shm_thread, NULL, shm_main, seg) != 0)
+    {
+        shm_running = 0;
+        munmap(seg, sizeof(struct m61_shm));
+        shm_segment = NULL;
+        shm_unlink(shm_name);
+        return -1;
+    }
+    if (!registered)
+    {
+        registered = 1;
+        atexit(m61_shm_stop);
+    }
+    return 0;
+}
+
+// start an export if M61_SHM names an interval in milliseconds
+__attribute__((constructor)) static void m61_shm_init(void)
+{
+    const char *interval = getenv("M61_SHM");
+    if (interval && *interval && m61_shm_start(strtoul(interval, NULL, 0)) != 0)
+    {
+        fprintf(stderr, "m61: cannot create shared memory object for statistics\n");
+    }
+}
+
+// LD_PRELOAD shim
+// libm61.so is m61.c built with M61_PRELOAD=1 (`make libm61.so`). It
+// defines the C library's allocation functions, so a dynamically linked
+// program run with LD_PRELOAD=./libm61.so allocates through m61 without
+// being rebuilt against m61.h. With no file:line to go on, a call site is
+// the return address into the program: the first call from each one names
+// it MODULE+0xOFFSET through dladdr, where OFFSET is the address of the
+// call that `addr2line -e MODULE` expects, and that name, with line 0,
+// stands for the site in every report, trace and heavy hitter list.
+// m61 itself, and the C library functions it calls (backtrace, fopen,
+// dladdr, atexit), may allocate too. A per-thread depth count sends those
+// nested calls to preload_bootstrap, a static bump arena whose blocks are
+// never reused, so they cannot recurse into m61 or wait on its locks;
+// free ignores bootstrap blocks wherever they are freed from.
+#if M61_PRELOAD
+#define PRELOAD_BOOTSTRAP_SIZE (1 << 20)
+#define PRELOAD_NAMES_SIZE (2 << 20) // bytes of site names
+#define PRELOAD_NAME_MAX 96          // longer names are truncated
+
+typedef struct preload_pc
+{
+    void *pc;         // return address, NULL if the slot is empty
+    const char *name; // its site name, in preload_names
+} preload_pc;
+
+static char preload_bootstrap[PRELOAD_BOOTSTRAP_SIZE] __attribute__((aligned(16)));
+static size_t preload_bootstrap_used = 0;
+static __thread int preload_depth = 0; // inside a shim function
+static preload_pc preload_pcs[2 * M61_MAXSITES];
+static unsigned preload_npcs = 0;
+static char preload_names[PRELOAD_NAMES_SIZE];
+static size_t preload_names_used = 0;
+static pthread_mutex_t preload_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// allocate `sz` bytes aligned to `align` from the bootstrap arena, which
+// is zero-filled and never reused; the size goes in the word before the
+// payload
+static void *bootstrap_alloc(size_t align, size_t sz)
+{
+    align = align < 16 ? 16 : align;
+    if (sz > PRELOAD_BOOTSTRAP_SIZE || align > PRELOAD_BOOTSTRAP_SIZE)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t used = __atomic_load_n(&preload_bootstrap_used, __ATOMIC_RELAXED);
+    size_t start, end;
+    do
+    {
+        start = (used + sizeof(size_t) + align - 1) & ~(align - 1);
+        end = start + ((sz + 15) & ~(size_t)15);
+        if (end > PRELOAD_BOOTSTRAP_SIZE)
+        {
+            errno = ENOMEM;
+            return NULL;
+        }
+    } while (!__atomic_compare_exchange_n(&preload_bootstrap_used, &used, end, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    ((size_t *)(preload_bootstrap + start))[-1] = sz;
+    return preload_bootstrap + start;
+}
+
+static int bootstrapped(void *ptr)
+{
+    return (char *)ptr >= preload_bootstrap && (char *)ptr < preload_bootstrap + PRELOAD_BOOTSTRAP_SIZE;
+}
+
+// return the payload size of `ptr`, from either m61 or the bootstrap arena
+static size_t preload_size(void *ptr)
+{
+    if (!ptr)
+    {
+        return 0;
+    }
+    return bootstrapped(ptr) ? ((size_t *)ptr)[-1] : ((struct m61_metadata *)ptr - 1)->size;
+}
+
+// look for `pc` in preload_pcs; return its name, or NULL and the empty
+// slot where it belongs
+static const char *find_pc(void *pc, size_t *slot)
+{
+    size_t i = hash_site((const char *)pc, 0) & (2 * M61_MAXSITES - 1);
+    void *p;
+    while ((p = __atomic_load_n(&preload_pcs[i].pc, __ATOMIC_ACQUIRE)) != NULL)
+    {
+        if (p == pc)
+        {
+            return preload_pcs[i].name;
+        }
+        i = (i + 1) & (2 * M61_MAXSITES - 1);
+    }
+    *slot = i;
+    return NULL;
+}
+
+// return the site name of return address `pc`, naming it if it is new.
+// Past M61_MAXSITES return addresses, every new one is "?".
+static const char *preload_site(void *pc)
+{
+    size_t slot = 0;
+    const char *name = find_pc(pc, &slot);
+    if (name)
+    {
+        return name;
+    }
+
+    // name the call instruction, which ends just before `pc`. dladdr
+    // takes the loader's lock, so call it before taking ours.
+    char buf[PRELOAD_NAME_MAX];
+    Dl_info info;
+    struct link_map *map;
+    if (dladdr1((char *)pc - 1, &info, (void **)&map, RTLD_DL_LINKMAP) && info.dli_fname)
+    {
+        const char *module = strrchr(info.dli_fname, '/');
+        module = module ? module + 1 : info.dli_fname;
+        snprintf(buf, sizeof(buf), "%s+0x%" PRIxPTR, *module ? module : program_invocation_short_name,
+                 (uintptr_t)pc - 1 - (uintptr_t)map->l_addr);
+    }
+    else
+    {
+        snprintf(buf, sizeof(buf), "%p", pc);
+    }
+
+    pthread_mutex_lock(&preload_lock);
+    // another thread may have added it since we looked
+    name = find_pc(pc, &slot);
+    size_t len = strlen(buf) + 1;
+    if (!name && preload_npcs < M61_MAXSITES && preload_names_used + len <= PRELOAD_NAMES_SIZE)
+    {
+        char *copy = preload_names + preload_names_used;
+        memcpy(copy, buf, len);
+        preload_names_used += len;
+        ++preload_npcs;
+        preload_pcs[slot].name = copy;
+        __atomic_store_n(&preload_pcs[slot].pc, pc, __ATOMIC_RELEASE);
+        name = copy;
+    }
+    pthread_mutex_unlock(&preload_lock);
+    return name ? name : "?";
+}
+
+// allocate `sz` bytes aligned to `align` (0 for the default) for the
+// program's call returning to `caller`, or from the bootstrap arena if
+// this is a nested call
+static void *preload_alloc(size_t align, size_t sz, void *caller)
+{
+    if (preload_depth)
+    {
+        return bootstrap_alloc(align, sz);
+    }
+    ++preload_depth;
+    const char *site = preload_site(caller);
+    void *ptr = align ? allocate_aligned(align, sz, site, 0, caller) : allocate(sz, 0, 0, site, 0, caller);
+    --preload_depth;
+    if (!ptr)
+    {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void *malloc(size_t sz)
+{
+    return preload_alloc(0, sz, __builtin_return_address(0));
+}
+
+void free(void *ptr)
+{
+    // a nested free of an m61 block leaks it rather than reenter m61
+    if (!ptr || bootstrapped(ptr) || preload_depth)
+    {
+        return;
+    }
+    int saved_errno = errno;
+    ++preload_depth;
+    m61_free(ptr, preload_site(__builtin_return_address(0)), 0);
+    --preload_depth;
+    errno = saved_errno;
+}
+
+void *calloc(size_t nmemb, size_t sz)
+{
+    if (preload_depth)
+    {
+        size_t total;
+        if (__builtin_mul_overflow(nmemb, sz, &total))
+        {
+            errno = ENOMEM;
+            return NULL;
+        }
+        return bootstrap_alloc(0, total);
+    }
+    ++preload_depth;
+    void *caller = __builtin_return_address(0);
+    void *ptr = allocate_zeroed(nmemb, sz, preload_site(caller), 0, caller);
+    --preload_depth;
+    if (!ptr)
+    {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t sz)
+{
+    void *caller = __builtin_return_address(0);
+    if (!preload_depth && !bootstrapped(ptr))
+    {
+        ++preload_depth;
+        void *new_ptr = reallocate(ptr, sz, preload_site(caller), 0, caller);
+        --preload_depth;
+        if (!new_ptr && sz)
+        {
+            errno = ENOMEM;
+        }
+        return new_ptr;
+    }
+    // a bootstrap block, or a nested call: copy into a new block
+    void *new_ptr = NULL;
+    if (sz)
+    {
+        new_ptr = preload_alloc(0, sz, caller);
+        if (!new_ptr)
+        {
+            return NULL;
+        }
+        size_t old_sz = preload_size(ptr);
+        memcpy(new_ptr, ptr, old_sz < sz ? old_sz : sz);
+    }
+    free(ptr);
+    return new_ptr;
+}
+
+int posix_memalign(void **memptr, size_t align, size_t sz)
+{
+    if (align == 0 || align % sizeof(void *) != 0 || (align & (align - 1)) != 0)
+    {
+        return EINVAL;
+    }
+    int saved_errno = errno;
+    void *ptr = preload_alloc(align, sz, __builtin_return_address(0));
+    errno = saved_errno;
+    if (!ptr)
+    {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+// the C library's other aligned allocators must come here too, since
+// their blocks are freed with our free
+
+void *memalign(size_t align, size_t sz)
+{
+    if (align == 0 || (align & (align - 1)) != 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    return preload_alloc(align, sz, __builtin_return_address(0));
+}
+
+void *aligned_alloc(size_t align, size_t sz)
+{
+    if (align == 0 || (align & (align - 1)) != 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    return preload_alloc(align, sz, __builtin_return_address(0));
+}
+
+void *valloc(size_t sz)
+{
+    return preload_alloc(page_size, sz, __builtin_return_address(0));
+}
+
+void *pvalloc(size_t sz)
+{
+    // rounding up to a page must not wrap around
+    if (sz > SIZE_MAX - (page_size - 1))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return preload_alloc(page_size, (sz + page_size - 1) & ~(page_size - 1), __builtin_return_address(0));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    return preload_size(ptr);
+}
+#endif
+
+// fork
+// the child of a fork has only the thread that called fork, so an m61 lock
+// held by any other thread at that moment would stay locked in the child
+// forever. m61_prefork takes every lock first, outer locks before the ones
+// taken under them (base_lock, taken under several, comes last), and both
+// sides release them once the fork is done. The child also drops the
+// parent's statistics export thread and trace file.
+static m61_stats_shard *fork_shards; // shards whose hh_lock prefork took
+
+static void m61_prefork(void)
+{
+    pthread_mutex_lock(&shm_lock);
+    pthread_mutex_lock(&trace_lock);
+    pthread_mutex_lock(&arenas_lock);
+    pthread_mutex_lock(&lifetime_lock);
+    fork_shards = __atomic_load_n(&all_shards, __ATOMIC_ACQUIRE);
+    for (m61_stats_shard *shard = fork_shards; shard; shard = shard->next)
+    {
+        pthread_mutex_lock(&shard->hh_lock);
+    }
+    pthread_mutex_lock(&HH_lock);
+    pthread_mutex_lock(&stacks_lock);
+    pthread_mutex_lock(&sites_lock);
+#if M61_PRELOAD
+    pthread_mutex_lock(&preload_lock);
+#endif
+    pthread_mutex_lock(&shards_lock);
+#if !M61_COMPACT
+    for (int i = 0; i < M61_STRIPES; ++i)
+    {
+        pthread_mutex_lock(&active_stripes[i].lock);
+    }
+#endif
+    pthread_mutex_lock(&guard_lock);
+    for (int c = 0; c < SLAB_NCLASSES; ++c)
+    {
+        pthread_mutex_lock(&slab_classes[c].lock);
+    }
+    base_malloc_prefork();
+}
+
+static void m61_postfork_parent(void)
+{
+    base_malloc_postfork();
+    for (int c = SLAB_NCLASSES - 1; c >= 0; --c)
+    {
+        pthread_mutex_unlock(&slab_classes[c].lock);
+    }
+    pthread_mutex_unlock(&guard_lock);
+#if !M61_COMPACT
+    for (int i = M61_STRIPES - 1; i >= 0; --i)
+    {
+        pthread_mutex_unlock(&active_stripes[i].lock);
+    }
+#endif
+    pthread_mutex_unlock(&shards_lock);
+#if M61_PRELOAD
+    pthread_mutex_unlock(&preload_lock);
+#endif
+    pthread_mutex_unlock(&sites_lock);
+    pthread_mutex_unlock(&stacks_lock);
+    pthread_mutex_unlock(&HH_lock);
+    for (m61_stats_shard *shard = fork_shards; shard; shard = shard->next)
+    {
+        pthread_mutex_unlock(&shard->hh_lock);
+    }
+    pthread_mutex_unlock(&lifetime_lock);
+    pthread_mutex_unlock(&arenas_lock);
+    pthread_mutex_unlock(&trace_lock);
+    pthread_mutex_unlock(&shm_lock);
+}
+
+static void m61_postfork_child(void)
+{
+    // the export thread was not copied, and the shared memory object and
+    // trace file are the parent's; leave them alone
+    shm_running = 0;
+    shm_segment = NULL;
+    pthread_cond_init(&shm_cond, NULL);
+    __atomic_store_n(&trace_on, 0, __ATOMIC_RELAXED);
+    trace_file = NULL;
+    m61_postfork_parent();
+    // trace buffers are not locked across fork; another thread's may be
+    // held, and all hold the parent's records
+    for (m61_stats_shard *shard = all_shards; shard; shard = shard->next)
+    {
+        if (shard->trace)
+        {
+            pthread_mutex_init(&shard->trace->lock, NULL);
+            shard->trace->len = TRACE_HEADER;
+            shard->trace->last_addr = 0;
+            shard->trace->last_time = 0;
+        }
+    }
+    // a shard created while prefork ran may have been left with its hh_lock
+    // held by a thread that no longer exists
+    for (m61_stats_shard *shard = all_shards; shard != fork_shards; shard = shard->next)
+    {
+        pthread_mutex_init(&shard->hh_lock, NULL);
+    }
+}
+
+__attribute__((constructor)) static void m61_fork_init(void)
+{
+    pthread_atfork(m61_prefork, m61_postfork_parent, m61_postfork_child);
+}
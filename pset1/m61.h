@@ -14,9 +14,32 @@ void m61_free(void* ptr, const char* file, int line);
 
 /// m61_realloc(ptr, sz, file, line)
 ///    Reallocate the dynamic memory pointed to by `ptr` to hold at least
-///    `sz` bytes, returning a pointer to the new block.
+///    `sz` bytes, returning a pointer to the new block. The block stays
+///    where it is if it has room.
 void* m61_realloc(void* ptr, size_t sz, const char* file, int line);
 
+/// m61_memalign(align, sz, file, line)
+///    Return a pointer to `sz` bytes of newly-allocated dynamic memory
+///    aligned to `align` bytes, or NULL if `align` is not a power of 2.
+///    Padding goes in front of the block's metadata, which still sits just
+///    before the payload, so `m61_free` and its checks work as usual.
+void* m61_memalign(size_t align, size_t sz, const char* file, int line);
+
+/// m61_aligned_alloc(align, sz, file, line)
+///    Same as `m61_memalign` (C11 `aligned_alloc`).
+void* m61_aligned_alloc(size_t align, size_t sz, const char* file, int line);
+
+/// m61_malloc_batch(ptrs, n, sz, file, line)
+///    Allocate `n` blocks of `sz` bytes, storing them in `ptrs[0..n-1]`,
+///    and return the number allocated (the rest of `ptrs` is set to NULL).
+///    Statistics and bookkeeping are updated once for the whole batch.
+///    Each block may be freed by `m61_free` or `m61_free_batch`.
+size_t m61_malloc_batch(void** ptrs, size_t n, size_t sz, const char* file, int line);
+
+/// m61_free_batch(ptrs, n, file, line)
+///    Free the blocks in `ptrs[0..n-1]`, skipping NULL entries.
+void m61_free_batch(void** ptrs, size_t n, const char* file, int line);
+
 /// m61_calloc(nmemb, sz, file, line)
 ///    Return a pointer to newly-allocated dynamic memory big enough to
 ///    hold an array of `nmemb` elements of `sz` bytes each. The memory
@@ -35,6 +58,11 @@ struct m61_statistics {
     unsigned long long fail_size;       // # bytes in failed alloc attempts
     char* heap_min;                     // smallest allocated addr
     char* heap_max;                     // largest allocated addr
+    unsigned long long narenas;         // # active arenas
+    unsigned long long arena_ntotal;    // # arenas ever created
+    unsigned long long arena_nobjects;  // # objects in active arenas
+    unsigned long long arena_size;      // # bytes in objects in arenas
+    unsigned long long arena_chunk_size; // # bytes in chunks held by arenas
 };
 
 /// m61_getstatistics(stats)
@@ -47,9 +75,244 @@ void m61_printstatistics(void);
 
 /// m61_printleakreport()
 ///    Print a report of all currently-active allocated blocks of dynamic
-///    memory.
+///    memory and of every arena not yet destroyed.
 void m61_printleakreport(void);
 
+/// m61_set_leak_report(mode)
+///    Choose the leak report format. M61_LEAK_BLOCKS, the default, prints
+///    one line per leaked block. M61_LEAK_SITES prints one line per call
+///    site with the count, total bytes and one address of its leaked
+///    blocks, largest first, and takes O(n) time in the number of leaks.
+///    M61_LEAK_STACKS also splits each site by the backtrace recorded
+///    with m61_set_stack_sample and prints it. The environment variable
+///    `M61_LEAK_REPORT` (`blocks`, `sites` or `stacks`) sets the initial
+///    mode.
+#define M61_LEAK_BLOCKS         0
+#define M61_LEAK_SITES          1
+#define M61_LEAK_STACKS         2
+void m61_set_leak_report(int mode);
+
+/// m61_fragmentation_report()
+///    Print live payload bytes against block overhead (header, canary,
+///    slack) and against the bytes reserved from base_malloc, a histogram
+///    of live blocks by size class, and the largest free extents m61
+///    holds: runs of quarantined, cached, slab-free and base_malloc-free
+///    blocks that are adjacent in memory. Call it while no other thread is
+///    allocating.
+void m61_fragmentation_report(void);
+
+/// m61_set_lifetime_sample(rate)
+///    Measure the lifetime of about one allocation in `rate` (default 64;
+///    1 measures every allocation, 0 none), in a log2 histogram per call
+///    site. The environment variable `M61_LIFETIME_SAMPLE` sets the initial
+///    rate.
+void m61_set_lifetime_sample(size_t rate);
+
+/// m61_set_stack_sample(rate)
+///    Record backtraces (up to 8 frames) about once every `rate` allocated
+///    bytes, so an allocation of `sz` bytes is recorded with probability
+///    1 - exp(-sz/`rate`); 1 records every allocation, 0 (the default)
+///    none. Equal backtraces are stored once and blocks keep a 32-bit id.
+///    The heavy hitter report and the M61_LEAK_STACKS leak report group by
+///    them. The environment variable `M61_STACK_SAMPLE` sets the initial
+///    rate.
+void m61_set_stack_sample(size_t rate);
+
+/// m61_print_lifetime_report()
+///    Print the call sites with the most bytes freed within 1 ms and the
+///    sites with the most bytes living 1 s or more (or still live), each
+///    with a histogram of lifetimes.
+void m61_print_lifetime_report(void);
+
+/// m61_arena
+///    A region whose objects are allocated by bumping a pointer and are
+///    all released together. An arena may be used by one thread at a time.
+typedef struct m61_arena m61_arena;
+
+/// M61_ARENA_CANARY
+///    Arena flag: follow each object with a canary, checked on reset and
+///    destroy.
+#define M61_ARENA_CANARY        1
+
+/// m61_arena_create(flags, file, line)
+///    Return a new, empty arena with the given flags.
+m61_arena* m61_arena_create(int flags, const char* file, int line);
+
+/// m61_arena_alloc(arena, sz, file, line)
+///    Return a pointer to `sz` bytes from `arena`, valid until the arena
+///    is reset or destroyed. Never pass it to m61_free.
+void* m61_arena_alloc(m61_arena* arena, size_t sz, const char* file, int line);
+
+/// m61_arena_reset(arena, file, line)
+///    Release every object in `arena`, keeping one chunk for reuse.
+void m61_arena_reset(m61_arena* arena, const char* file, int line);
+
+/// m61_arena_destroy(arena, file, line)
+///    Release every object in `arena` and the arena itself.
+void m61_arena_destroy(m61_arena* arena, const char* file, int line);
+
+/// m61_set_quarantine(max_bytes, max_blocks)
+///    Hold freed blocks back from reuse: each thread keeps up to
+///    `max_blocks` (at most 4096) freed blocks totalling at most
+///    `max_bytes`, poisoned, and checks the poison when the oldest is
+///    evicted, reporting writes through dangling pointers. The default is
+///    256 KiB and 1024 blocks; `max_blocks == 0` turns quarantine off. The
+///    environment variables `M61_QUARANTINE_BYTES` and
+///    `M61_QUARANTINE_BLOCKS` set the initial limits.
+void m61_set_quarantine(size_t max_bytes, size_t max_blocks);
+
+/// m61_flush_quarantine()
+///    Check and release every block in the calling thread's quarantine.
+void m61_flush_quarantine(void);
+
+/// m61_set_tcache(max_blocks)
+///    Keep up to `max_blocks` freed blocks of each small size class in a
+///    per-thread cache (default 64), so threads reuse their own blocks
+///    without taking shared locks. Blocks reach the cache after leaving the
+///    quarantine. 0 turns the caches off. The environment variable
+///    `M61_TCACHE_BLOCKS` sets the initial limit.
+void m61_set_tcache(size_t max_blocks);
+
+/// m61_set_mmap_threshold(min_size)
+///    Give each block of at least `min_size` bytes (default 256 KiB) its
+///    own mapping, unmapped as soon as it is freed, so memory goes back to
+///    the system after a spike of large allocations. 0 turns this off. The
+///    environment variable `M61_MMAP_THRESHOLD` sets the initial threshold.
+void m61_set_mmap_threshold(size_t min_size);
+
+/// m61_set_guard(min_size)
+///    Serve blocks of at least `min_size` bytes from mappings that end in
+///    an inaccessible guard page, with the payload placed against it (up
+///    to 16-byte alignment), so an overrun faults immediately. Freed
+///    guarded blocks are made inaccessible too and their mappings are
+///    pooled for reuse. 0 (the default) turns guard pages off. The
+///    environment variable `M61_GUARD` sets the initial threshold.
+void m61_set_guard(size_t min_size);
+
+/// m61_heavyhitter
+///    One call site monitored by the heavy hitter sketch. The true number
+///    of bytes allocated at the site lies in [size - error, size].
+struct m61_heavyhitter {
+    const char* file;                   // file of the call site
+    int line;                           // line of the call site
+    unsigned long long count;           // # allocations since monitored
+    unsigned long long size;            // estimated # bytes (upper bound)
+    unsigned long long error;           // max overestimate of `size`
+};
+
+/// m61_heavyhitter_init(k)
+///    Reset the heavy hitter sketch so it monitors at most `k` call sites
+///    (default 1024). Memory use is fixed at O(k), and each reported size
+///    overestimates the truth by at most (total bytes) / `k`.
+void m61_heavyhitter_init(size_t k);
+
+/// m61_getheavyhitters(hh, n)
+///    Store up to `n` monitored call sites in `hh`, largest first, and
+///    return the number stored.
+size_t m61_getheavyhitters(struct m61_heavyhitter* hh, size_t n);
+
+/// m61_set_sample_rate(rate)
+///    Sample heavy hitters about once every `rate` allocated bytes
+///    (geometric intervals, so every byte is equally likely to be sampled).
+///    Reported sizes and counts are scaled up to unbiased estimates. 0, the
+///    default, records every allocation. The environment variable
+///    `M61_SAMPLE_RATE` sets the initial rate.
+void m61_set_sample_rate(size_t rate);
+
+/// m61_get_sample_rate()
+///    Return the current heavy hitter sample rate in bytes.
+size_t m61_get_sample_rate(void);
+
+/// m61_trace_start(filename)
+///    Start writing a binary trace of every malloc, free, realloc and
+///    calloc to `filename`, ending any trace in progress. Returns 0 on
+///    success, -1 if the file cannot be created. Each thread buffers its
+///    records and writes them out in blocks of up to 64 KiB. The
+///    environment variable `M61_TRACE` starts a trace at startup, and
+///    `m61trace FILE` summarizes a trace.
+int m61_trace_start(const char* filename);
+
+/// m61_trace_stop()
+///    Write out every thread's buffered records and close the trace. No
+///    other thread may be allocating. Runs automatically at exit.
+void m61_trace_stop(void);
+
+// Trace format: the 8 bytes of M61_TRACE_MAGIC, then blocks. A block is a
+// 4-byte thread slot and a 4-byte length (little-endian), then that many
+// bytes of records. A record is an op byte followed by unsigned LEB128
+// varints; `sdelta` fields are zigzag-encoded signed differences. Address
+// and time deltas are from the previous record of the same block (from 0
+// for the first one).
+//     M61_TRACE_SITE     id, line, name length, name bytes
+//     M61_TRACE_MALLOC   site, size, sdelta address, time delta
+//     M61_TRACE_CALLOC   site, size, sdelta address, time delta
+//     M61_TRACE_FREE     site, size, sdelta address, time delta
+//     M61_TRACE_REALLOC  site, size, old size, sdelta address,
+//                        sdelta old address (from address), time delta
+// A REALLOC's size is 0 if no block was returned, its old size 0 if no
+// block was released. Each site's SITE record appears once, somewhere in
+// the file; site 0 is unknown. Times are TSC ticks on x86, else ns.
+#define M61_TRACE_MAGIC         "M61TRC01"
+#define M61_TRACE_SITE          1
+#define M61_TRACE_MALLOC        2
+#define M61_TRACE_FREE          3
+#define M61_TRACE_REALLOC       4
+#define M61_TRACE_CALLOC        5
+
+/// m61_shm_start(interval_ms)
+///    Publish the statistics and top heavy hitters in the POSIX shared
+///    memory object "/m61.PID" (a `struct m61_shm`) every `interval_ms`
+///    milliseconds, from a background thread, so tools like `m61top PID`
+///    can watch a running program. Allocation never waits on the export.
+///    Returns 0 on success, -1 on error. The environment variable `M61_SHM`
+///    starts an export with that interval at startup.
+int m61_shm_start(unsigned interval_ms);
+
+/// m61_shm_stop()
+///    Stop the export and remove the shared memory object. Runs
+///    automatically at exit.
+void m61_shm_stop(void);
+
+/// m61_shm
+///    Layout of the shared memory object. `seq` is a sequence lock: it is
+///    odd while an update is in progress and grows by 2 per update. Readers
+///    copy the structure and retry if `seq` was odd or changed meanwhile.
+#define M61_SHM_MAGIC           "M61SHM01"
+#define M61_SHM_NSITES          16
+
+struct m61_shm_site {
+    char file[104];                     // file name, truncated
+    int line;
+    unsigned long long count;           // # allocations (estimated)
+    unsigned long long size;            // # bytes allocated (estimated)
+};
+
+struct m61_shm {
+    char magic[8];                      // M61_SHM_MAGIC
+    unsigned long long seq;             // sequence lock
+    unsigned long long pid;             // process publishing
+    unsigned long long interval_ms;     // time between updates
+    unsigned long long time_ns;         // CLOCK_MONOTONIC time of update
+    struct m61_statistics stats;
+    unsigned long long nsites;          // # valid entries in `sites`
+    struct m61_shm_site sites[M61_SHM_NSITES]; // largest heavy hitters
+};
+
+/// m61_heavyHitterTest()
+///    Print a report of the call sites responsible for more than 10% of
+///    allocated bytes, then, if stacks are sampled, of the backtraces
+///    responsible for more than 10% of sampled bytes.
+void m61_heavyHitterTest(void);
+
+/// libm61.so
+///    `make libm61.so` builds m61 as a library defining malloc, free,
+///    calloc, realloc, posix_memalign, memalign, aligned_alloc, valloc,
+///    pvalloc and malloc_usable_size, to run programs that do not use this
+///    header: `LD_PRELOAD=./libm61.so PROGRAM`. A call site is named
+///    MODULE+0xOFFSET after the calling instruction (see `addr2line -e
+///    MODULE OFFSET`), with line 0. The environment variables above apply;
+///    `M61_TRACE` and `M61_SHM` report on the program. Requires glibc.
+
 
 #if !M61_DISABLE
 // Redefine the `malloc` family of calls to use our versions.
@@ -57,6 +320,14 @@ void m61_printleakreport(void);
 #define free(ptr)               m61_free((ptr), __FILE__, __LINE__)
 #define realloc(ptr, sz)        m61_realloc((ptr), (sz), __FILE__, __LINE__)
 #define calloc(nmemb, sz)       m61_calloc((nmemb), (sz), __FILE__, __LINE__)
+#define memalign(align, sz)     m61_memalign((align), (sz), __FILE__, __LINE__)
+#define aligned_alloc(align, sz) m61_aligned_alloc((align), (sz), __FILE__, __LINE__)
+#define malloc_batch(ptrs, n, sz) m61_malloc_batch((ptrs), (n), (sz), __FILE__, __LINE__)
+#define free_batch(ptrs, n)     m61_free_batch((ptrs), (n), __FILE__, __LINE__)
+#define arena_create(flags)     m61_arena_create((flags), __FILE__, __LINE__)
+#define arena_alloc(arena, sz)  m61_arena_alloc((arena), (sz), __FILE__, __LINE__)
+#define arena_reset(arena)      m61_arena_reset((arena), __FILE__, __LINE__)
+#define arena_destroy(arena)    m61_arena_destroy((arena), __FILE__, __LINE__)
 #endif
 
 
@@ -64,5 +335,8 @@ void m61_printleakreport(void);
 void* base_malloc(size_t sz);
 void base_free(void* ptr);
 void base_malloc_disable(int is_disabled);
+void base_malloc_foreach_free(void (*visit)(void* ptr, size_t sz, void* arg), void* arg);
+void base_malloc_prefork(void);
+void base_malloc_postfork(void);
 
 #endif
@@ -0,0 +1,141 @@
+#define M61_DISABLE 1
+#include "m61.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+// m61top: Watch the statistics of a running m61 program.
+//
+// Attaches to the shared memory object that m61_shm_start (or M61_SHM=MS)
+// publishes for PID and prints allocation and free rates, active blocks
+// and bytes, and the top allocation sites, refreshing every interval. It
+// only reads the object, so it never slows the program down.
+
+// copy a consistent snapshot of `seg` into `snap`; return 0 on success,
+// -1 if the publisher kept updating
+static int read_snapshot(const struct m61_shm* seg, struct m61_shm* snap) {
+    for (int tries = 0; tries < 1000; ++tries) {
+        unsigned long long seq = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+        if (!(seq & 1)) {
+            memcpy(snap, seg, sizeof(*snap));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&seg->seq, __ATOMIC_RELAXED) == seq) {
+                snap->seq = seq;
+                return 0;
+            }
+        }
+        sched_yield();
+    }
+    return -1;
+}
+
+static double rate(unsigned long long now, unsigned long long before,
+                   double seconds) {
+    return seconds > 0 ? (double) (now - before) / seconds : 0.0;
+}
+
+static void usage(int status) {
+    printf("Usage: m61top [-n NSITES] [-i SECONDS] [-c COUNT] PID\n\
+\n\
+  Show live allocation statistics of PID, which must be exporting them\n\
+  with m61_shm_start or M61_SHM=MILLISECONDS. Refreshes every SECONDS\n\
+  (default 1) COUNT times (default until PID exits), listing the NSITES\n\
+  (default 10) sites that allocated the most bytes.\n");
+    exit(status);
+}
+
+int main(int argc, char** argv) {
+    int nsites = 10;
+    double interval = 1.0;
+    long count = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:i:c:h")) != -1) {
+        if (opt == 'n') {
+            nsites = strtol(optarg, 0, 0);
+        } else if (opt == 'i') {
+            interval = strtod(optarg, 0);
+        } else if (opt == 'c') {
+            count = strtol(optarg, 0, 0);
+        } else {
+            usage(opt == 'h' ? 0 : 1);
+        }
+    }
+    if (optind + 1 != argc || interval <= 0) {
+        usage(1);
+    }
+
+    long pid = strtol(argv[optind], 0, 0);
+    char name[32];
+    snprintf(name, sizeof(name), "/m61.%ld", pid);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "m61top: %ld is not exporting m61 statistics (%s)\n",
+                pid, strerror(errno));
+        exit(1);
+    }
+    const struct m61_shm* seg = mmap(NULL, sizeof(struct m61_shm), PROT_READ,
+                                     MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED || memcmp(seg->magic, M61_SHM_MAGIC, 8) != 0) {
+        fprintf(stderr, "m61top: %s is not an m61 statistics object\n", name);
+        exit(1);
+    }
+    if (nsites > M61_SHM_NSITES) {
+        nsites = M61_SHM_NSITES;
+    }
+
+    int tty = isatty(STDOUT_FILENO);
+    struct m61_shm prev, cur;
+    if (read_snapshot(seg, &prev) != 0) {
+        fprintf(stderr, "m61top: cannot read %s\n", name);
+        exit(1);
+    }
+    for (long n = 0; count == 0 || n < count; ++n) {
+        usleep((useconds_t) (interval * 1e6));
+        if (kill(pid, 0) != 0 && errno == ESRCH) {
+            printf("m61top: process %ld exited\n", pid);
+            break;
+        }
+        if (read_snapshot(seg, &cur) != 0) {
+            continue;
+        }
+        double seconds = (cur.time_ns - prev.time_ns) / 1e9;
+        const struct m61_statistics* s = &cur.stats;
+        const struct m61_statistics* p = &prev.stats;
+
+        if (tty) {
+            printf("\033[H\033[J");
+        }
+        printf("pid %ld, updated every %llu ms\n", pid, cur.interval_ms);
+        printf("allocs/sec %12.0f   frees/sec %12.0f\n",
+               rate(s->ntotal, p->ntotal, seconds),
+               rate(s->ntotal - s->nactive, p->ntotal - p->nactive, seconds));
+        printf("active     %12llu blocks %16llu bytes\n",
+               s->nactive, s->active_size);
+        printf("total      %12llu blocks %16llu bytes\n",
+               s->ntotal, s->total_size);
+        printf("failed     %12llu blocks %16llu bytes\n",
+               s->nfail, s->fail_size);
+        if (s->arena_ntotal) {
+            printf("arenas     %12llu active %16llu bytes in objects\n",
+                   s->narenas, s->arena_size);
+        }
+        printf("top sites by bytes:\n");
+        for (unsigned long long i = 0; i < cur.nsites && i < (unsigned) nsites; ++i) {
+            printf("  %s:%d: %llu bytes in %llu allocations\n",
+                   cur.sites[i].file, cur.sites[i].line,
+                   cur.sites[i].size, cur.sites[i].count);
+        }
+        if (!tty) {
+            printf("\n");
+        }
+        fflush(stdout);
+        prev = cur;
+    }
+    return 0;
+}
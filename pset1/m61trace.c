@@ -0,0 +1,299 @@
+#define M61_DISABLE 1
+#include "m61.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+// m61trace: Summarize an allocation trace written by m61_trace_start.
+//
+// Prints event counts and bytes per operation, a log2 histogram of
+// allocation sizes, the call sites that allocated the most bytes, peak
+// live bytes, and events per thread. The trace format is described in
+// m61.h.
+
+#define MAXSITES (1 << 16)
+#define MAXTHREADS 4096
+
+typedef struct site {
+    char* file;                         // NULL until its SITE record is seen
+    unsigned line;
+    unsigned long long count;           // # allocations here
+    unsigned long long bytes;           // # bytes allocated here
+} site;
+
+typedef struct live_change {
+    uint64_t time;
+    long long delta;                    // change in live bytes
+} live_change;
+
+static const char* op_names[] = {
+    [M61_TRACE_MALLOC] = "malloc", [M61_TRACE_FREE] = "free",
+    [M61_TRACE_REALLOC] = "realloc", [M61_TRACE_CALLOC] = "calloc"
+};
+
+static site sites[MAXSITES];
+static unsigned long long op_count[6], op_bytes[6];
+static unsigned long long size_hist[65];
+static unsigned long long thread_count[MAXTHREADS];
+static unsigned nthreads;
+static live_change* changes;
+static size_t nchanges;
+static uint64_t first_time = UINT64_MAX, last_time;
+
+// cursor over the records of one block
+typedef struct reader {
+    const unsigned char* p;
+    const unsigned char* end;
+    int bad;                            // ran off the end of the block
+} reader;
+
+static uint64_t get(reader* r) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (r->p == r->end) {
+            r->bad = 1;
+            return 0;
+        }
+        unsigned char b = *r->p++;
+        v |= (uint64_t) (b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return v;
+        }
+    }
+    r->bad = 1;
+    return v;
+}
+
+static int64_t get_delta(reader* r) {
+    uint64_t z = get(r);
+    return (int64_t) (z >> 1) ^ -(int64_t) (z & 1);
+}
+
+static void add_change(uint64_t time, long long delta) {
+    static size_t capacity;
+    if (nchanges == capacity) {
+        capacity = capacity ? 2 * capacity : 4096;
+        changes = realloc(changes, capacity * sizeof(live_change));
+        if (!changes) {
+            fprintf(stderr, "m61trace: out of memory\n");
+            exit(1);
+        }
+    }
+    changes[nchanges].time = time;
+    changes[nchanges].delta = delta;
+    ++nchanges;
+}
+
+static void count_allocation(unsigned id, size_t sz) {
+    int bucket = 0;
+    while (bucket < 64 && ((uint64_t) 1 << bucket) <= sz) {
+        ++bucket;
+    }
+    ++size_hist[bucket];
+    ++sites[id].count;
+    sites[id].bytes += sz;
+}
+
+// parse one block. Pass 0 only collects SITE records, because a site's
+// record may come in a later block than its first use; pass 1 counts.
+static int scan_block(const unsigned char* data, size_t len,
+                      unsigned thread, int pass) {
+    reader r = {data, data + len, 0};
+    uintptr_t addr = 0;
+    uint64_t time = 0;
+    while (r.p < r.end && !r.bad) {
+        int op = *r.p++;
+        if (op == M61_TRACE_SITE) {
+            unsigned id = get(&r);
+            unsigned line = get(&r);
+            size_t name_len = get(&r);
+            if (r.bad || id >= MAXSITES || name_len > (size_t) (r.end - r.p)) {
+                return -1;
+            }
+            if (pass == 0 && !sites[id].file) {
+                sites[id].file = strndup((const char*) r.p, name_len);
+                sites[id].line = line;
+            }
+            r.p += name_len;
+            continue;
+        } else if (op < M61_TRACE_MALLOC || op > M61_TRACE_CALLOC) {
+            return -1;
+        }
+        unsigned id = get(&r);
+        size_t sz = get(&r);
+        size_t old_sz = op == M61_TRACE_REALLOC ? get(&r) : 0;
+        addr += get_delta(&r);
+        if (op == M61_TRACE_REALLOC) {
+            (void) get_delta(&r);       // old address
+        }
+        time += get(&r);
+        if (r.bad || id >= MAXSITES) {
+            return -1;
+        }
+        if (pass == 0) {
+            continue;
+        }
+
+        ++op_count[op];
+        op_bytes[op] += sz;
+        if (thread < MAXTHREADS) {
+            ++thread_count[thread];
+            if (thread >= nthreads) {
+                nthreads = thread + 1;
+            }
+        }
+        if (time < first_time) {
+            first_time = time;
+        }
+        if (time > last_time) {
+            last_time = time;
+        }
+        if (op == M61_TRACE_FREE) {
+            add_change(time, -(long long) sz);
+        } else {
+            if (sz) {
+                count_allocation(id, sz);
+            }
+            add_change(time, (long long) sz - (long long) old_sz);
+        }
+    }
+    return r.bad ? -1 : 0;
+}
+
+// parse every block; return the number of bytes of complete blocks
+static size_t scan(const unsigned char* data, size_t len, int pass) {
+    size_t pos = 8;
+    while (len - pos >= 8) {
+        uint32_t header[2] = {0, 0};
+        for (int i = 0; i < 8; ++i) {
+            header[i / 4] |= (uint32_t) data[pos + i] << (8 * (i % 4));
+        }
+        if (header[1] > len - pos - 8
+            || scan_block(data + pos + 8, header[1], header[0], pass) < 0) {
+            break;
+        }
+        pos += 8 + header[1];
+    }
+    return pos;
+}
+
+static int compare_changes(const void* a, const void* b) {
+    const live_change* x = a;
+    const live_change* y = b;
+    return x->time < y->time ? -1 : x->time > y->time;
+}
+
+static int compare_sites(const void* a, const void* b) {
+    const site* x = &sites[*(const unsigned*) a];
+    const site* y = &sites[*(const unsigned*) b];
+    return x->bytes < y->bytes ? 1 : x->bytes > y->bytes ? -1 : 0;
+}
+
+int main(int argc, char** argv) {
+    int ntop = 10;
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        ntop = strtol(argv[2], 0, 0);
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc != 2 || strcmp(argv[1], "-h") == 0
+        || strcmp(argv[1], "--help") == 0) {
+        printf("Usage: m61trace [-n NSITES] TRACEFILE\n\
+\n\
+  Summarize a trace written by m61_trace_start (or M61_TRACE=TRACEFILE),\n\
+  listing the NSITES (default 10) sites that allocated the most bytes.\n");
+        exit(argc == 2 ? 0 : 1);
+    }
+
+    FILE* f = fopen(argv[1], "rb");
+    if (!f) {
+        perror(argv[1]);
+        exit(1);
+    }
+    size_t len = 0, capacity = 1 << 20;
+    unsigned char* data = malloc(capacity);
+    size_t n;
+    while (data && (n = fread(data + len, 1, capacity - len, f)) > 0) {
+        len += n;
+        if (len == capacity) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+    }
+    fclose(f);
+    if (!data) {
+        fprintf(stderr, "m61trace: out of memory\n");
+        exit(1);
+    }
+    if (len < 8 || memcmp(data, M61_TRACE_MAGIC, 8) != 0) {
+        fprintf(stderr, "%s: not an m61 trace\n", argv[1]);
+        exit(1);
+    }
+
+    sites[0].file = "?";
+    scan(data, len, 0);
+    size_t used = scan(data, len, 1);
+    if (used != len) {
+        fprintf(stderr, "%s: ignoring %zu bytes of damaged or truncated data\n",
+                argv[1], len - used);
+    }
+
+    // events
+    unsigned long long nevents = 0;
+    for (int op = M61_TRACE_MALLOC; op <= M61_TRACE_CALLOC; ++op) {
+        nevents += op_count[op];
+    }
+    printf("%llu events in %zu bytes (%.1f bytes/event), %llu ticks\n",
+           nevents, len, nevents ? (double) len / nevents : 0.0,
+           nevents ? (unsigned long long) (last_time - first_time) : 0ULL);
+    for (int op = M61_TRACE_MALLOC; op <= M61_TRACE_CALLOC; ++op) {
+        printf("  %-8s %12llu events %16llu bytes\n",
+               op_names[op], op_count[op], op_bytes[op]);
+    }
+
+    // peak live bytes, with events from all threads in time order
+    qsort(changes, nchanges, sizeof(live_change), compare_changes);
+    long long live = 0, peak = 0;
+    for (size_t i = 0; i < nchanges; ++i) {
+        live += changes[i].delta;
+        if (live > peak) {
+            peak = live;
+        }
+    }
+    printf("peak live bytes %lld, live at end %lld\n", peak, live);
+
+    printf("allocation sizes:\n");
+    for (int b = 0; b <= 64; ++b) {
+        if (size_hist[b]) {
+            printf("  %10llu - %-20llu %12llu\n",
+                   b ? 1ULL << (b - 1) : 0ULL,
+                   b < 64 ? (1ULL << b) - 1 : ~0ULL, size_hist[b]);
+        }
+    }
+
+    unsigned* order = malloc(MAXSITES * sizeof(unsigned));
+    unsigned nsites = 0;
+    for (unsigned id = 0; id < MAXSITES; ++id) {
+        if (sites[id].count) {
+            order[nsites++] = id;
+        }
+    }
+    qsort(order, nsites, sizeof(unsigned), compare_sites);
+    printf("top sites by bytes (%u sites):\n", nsites);
+    for (unsigned i = 0; i < nsites && i < (unsigned) ntop; ++i) {
+        site* s = &sites[order[i]];
+        printf("  %s:%u: %llu bytes in %llu allocations\n",
+               s->file ? s->file : "?", s->line, s->bytes, s->count);
+    }
+
+    printf("events by thread:\n");
+    for (unsigned t = 0; t < nthreads; ++t) {
+        if (thread_count[t]) {
+            printf("  thread %u: %llu\n", t, thread_count[t]);
+        }
+    }
+    free(order);
+    free(changes);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,45 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+// Concurrent malloc and free from many threads.
+
+#define NTHREADS 8
+#define NALLOCS 10000
+
+static void* thread_main(void* arg) {
+    (void) arg;
+    char* ptrs[NALLOCS];
+    for (int i = 0; i < NALLOCS; ++i) {
+        ptrs[i] = (char*) malloc(i % 64 + 1);
+        memset(ptrs[i], i, i % 64 + 1);
+        // free some blocks right away so mallocs and frees interleave
+        if (i % 3 == 1 && i % 10 != 0) {
+            free(ptrs[i]);
+            ptrs[i] = NULL;
+        }
+    }
+    // keep every tenth block; the totals below count them
+    for (int i = 0; i < NALLOCS; ++i) {
+        if (i % 10 != 0) {
+            free(ptrs[i]);
+        }
+    }
+    return NULL;
+}
+
+int main() {
+    pthread_t threads[NTHREADS];
+    for (int i = 0; i < NTHREADS; ++i) {
+        int r = pthread_create(&threads[i], NULL, thread_main, NULL);
+        assert(r == 0);
+    }
+    for (int i = 0; i < NTHREADS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    m61_printstatistics();
+}
+
+//! malloc count: active       8000   total      80000   fail          0
+//! malloc size:  active     255744   total    2596928   fail          0
@@ -0,0 +1,16 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Use after free detected by the quarantine.
+
+int main() {
+    char* ptr = (char*) malloc(100);
+    free(ptr);
+    ptr[50] = 'x';
+    m61_flush_quarantine();
+    m61_printstatistics();
+}
+
+//! MEMORY BUG: test???.c:8: use after free: freed object ??? with size 100 was written 50 bytes in
+//! ???
@@ -0,0 +1,24 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Realloc grows and shrinks in place once a block has room.
+
+int main() {
+    char* p = (char*) malloc(100);
+    memset(p, 'a', 100);
+    p = (char*) realloc(p, 200);
+    memset(p + 100, 'b', 100);
+    // the moved block has room to grow
+    char* q = (char*) realloc(p, 250);
+    assert(q == p);
+    // shrinking a little stays put
+    q = (char*) realloc(q, 200);
+    assert(q == p);
+    assert(q[0] == 'a' && q[99] == 'a' && q[100] == 'b' && q[199] == 'b');
+    free(q);
+    m61_printstatistics();
+}
+
+//! malloc count: active          0   total          4   fail          0
+//! malloc size:  active          0   total        750   fail          0
@@ -0,0 +1,18 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Overflow after an in-place realloc.
+
+int main() {
+    char* p = (char*) malloc(100);
+    p = (char*) realloc(p, 200);
+    char* q = (char*) realloc(p, 250);
+    assert(q == p);
+    q[250] = 'x';
+    free(q);
+    m61_printstatistics();
+}
+
+//! MEMORY BUG???: detected wild write during free of pointer ???
+//! ???
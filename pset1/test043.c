@@ -0,0 +1,27 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Batch allocation: blocks are separate and can be freed singly or in a batch.
+
+int main() {
+    void* ptrs[100];
+    size_t n = malloc_batch(ptrs, 100, 24);
+    assert(n == 100);
+    for (int i = 0; i < 100; ++i) {
+        assert(ptrs[i]);
+        memset(ptrs[i], i, 24);
+    }
+    for (int i = 0; i < 100; i += 10) {
+        free(ptrs[i]);
+        ptrs[i] = NULL;
+    }
+    m61_printstatistics();
+    free_batch(ptrs, 100);
+    m61_printstatistics();
+}
+
+//! malloc count: active         90   total        100   fail          0
+//! malloc size:  active       2160   total       2400   fail          0
+//! malloc count: active          0   total        100   fail          0
+//! malloc size:  active          0   total       2400   fail          0
@@ -0,0 +1,15 @@
+#include "m61.h"
+#include <stdio.h>
+// A block listed twice in a batch free is a double free.
+
+int main() {
+    void* ptrs[3];
+    malloc_batch(ptrs, 2, 16);
+    ptrs[2] = ptrs[0];
+    free_batch(ptrs, 3);
+    m61_printstatistics();
+}
+
+//! MEMORY BUG: test???.c:9: invalid free of pointer ???, double free
+//! malloc count: active          0   total          2   fail          0
+//! malloc size:  active          0   total         32   fail          0
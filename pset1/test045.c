@@ -0,0 +1,38 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Arena objects are counted by arena and released together.
+
+int main() {
+    m61_arena* arena = arena_create(0);
+    char* prev = NULL;
+    for (int i = 0; i < 100; ++i) {
+        char* p = (char*) arena_alloc(arena, 10);
+        assert(p && p != prev && ((uintptr_t) p & 15) == 0);
+        memset(p, 'a', 10);
+        prev = p;
+    }
+    char* big = (char*) arena_alloc(arena, 100000);
+    assert(big);
+    memset(big, 'b', 100000);
+    m61_printstatistics();
+    arena_reset(arena);
+    m61_printstatistics();
+    assert(arena_alloc(arena, 10));
+    arena_destroy(arena);
+    m61_printstatistics();
+}
+
+//! malloc count: active          0   total          0   fail          0
+//! malloc size:  active          0   total          0   fail          0
+//! arena count:  active          1   total          1   objects     101
+//! arena size:   objects    101000   chunks    165568
+//! malloc count: active          0   total          0   fail          0
+//! malloc size:  active          0   total          0   fail          0
+//! arena count:  active          1   total          1   objects       0
+//! arena size:   objects         0   chunks     65536
+//! malloc count: active          0   total          0   fail          0
+//! malloc size:  active          0   total          0   fail          0
+//! arena count:  active          0   total          1   objects       0
+//! arena size:   objects         0   chunks         0
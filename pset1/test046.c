@@ -0,0 +1,19 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Canary arenas catch overflows when the arena is destroyed.
+
+int main() {
+    m61_arena* arena = arena_create(M61_ARENA_CANARY);
+    char* p = (char*) arena_alloc(arena, 20);
+    char* q = (char*) arena_alloc(arena, 20);
+    memset(q, 'q', 20);
+    memset(p, 'p', 24);
+    arena_destroy(arena);
+    m61_printstatistics();
+}
+
+//! MEMORY BUG: test046.c:13: detected wild write in arena ???
+//!   test046.c:9: after 20 byte object ??? allocated here
+//! ???
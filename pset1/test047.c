@@ -0,0 +1,21 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// The leak report lists leaked arenas, not their objects.
+
+int main() {
+    m61_arena* kept = arena_create(0);
+    m61_arena* gone = arena_create(M61_ARENA_CANARY);
+    for (int i = 0; i < 10; ++i) {
+        arena_alloc(kept, 8);
+        arena_alloc(gone, 8);
+    }
+    void* leaked = malloc(5);
+    arena_destroy(gone);
+    (void) leaked;
+    m61_printleakreport();
+}
+
+//! LEAK CHECK: test047.c:14: allocated object ??? with size 5
+//! LEAK CHECK: test047.c:8: allocated arena ??? with 10 objects of size 80
@@ -0,0 +1,48 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+// Thread caches reuse freed blocks, including blocks from other threads,
+// and statistics stay exact.
+
+#define NALLOCS 1000
+
+static char* ptrs[NALLOCS];
+
+static void* thread_main(void* arg) {
+    (void) arg;
+    // free the main thread's blocks into this thread's cache, then reuse
+    for (int i = 0; i < NALLOCS; ++i) {
+        free(ptrs[i]);
+        ptrs[i] = (char*) malloc(40);
+        memset(ptrs[i], 'x', 40);
+    }
+    return NULL;
+}
+
+int main() {
+    m61_set_quarantine(0, 0);
+    char* p = (char*) malloc(24);
+    free(p);
+    char* q = (char*) malloc(24);
+    assert(q == p);
+    free(q);
+
+    for (int i = 0; i < NALLOCS; ++i) {
+        ptrs[i] = (char*) malloc(40);
+    }
+    pthread_t t;
+    pthread_create(&t, NULL, thread_main, NULL);
+    pthread_join(t, NULL);
+    m61_printstatistics();
+    for (int i = 0; i < NALLOCS; ++i) {
+        free(ptrs[i]);
+    }
+    m61_printstatistics();
+}
+
+//! malloc count: active       1000   total       2002   fail          0
+//! malloc size:  active      40000   total      80048   fail          0
+//! malloc count: active          0   total       2002   fail          0
+//! malloc size:  active          0   total      80048   fail          0
@@ -0,0 +1,53 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+// Statistics are exported through a shared memory object.
+
+int main() {
+    assert(m61_shm_start(10) == 0);
+    void* ptrs[10];
+    for (int i = 0; i < 10; ++i) {
+        ptrs[i] = malloc(100);
+    }
+    free(ptrs[0]);
+
+    char name[32];
+    snprintf(name, sizeof(name), "/m61.%ld", (long) getpid());
+    int fd = shm_open(name, O_RDONLY, 0);
+    assert(fd >= 0);
+    const struct m61_shm* seg = (const struct m61_shm*)
+        mmap(NULL, sizeof(struct m61_shm), PROT_READ, MAP_SHARED, fd, 0);
+    assert(seg != MAP_FAILED && memcmp(seg->magic, M61_SHM_MAGIC, 8) == 0);
+    // wait for an update that started after the allocations
+    unsigned long long seq = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+    while (__atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE) < (seq | 1) + 3) {
+        usleep(1000);
+    }
+    struct m61_shm snap;
+    do {
+        seq = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+        memcpy(&snap, seg, sizeof(snap));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || __atomic_load_n(&seg->seq, __ATOMIC_RELAXED) != seq);
+
+    printf("pid ok %d\n", snap.pid == (unsigned long long) getpid());
+    printf("active %llu %llu total %llu %llu\n",
+           snap.stats.nactive, snap.stats.active_size,
+           snap.stats.ntotal, snap.stats.total_size);
+    printf("site %s:%d %llu\n", snap.sites[0].file, snap.sites[0].line,
+           snap.sites[0].size);
+
+    m61_shm_stop();
+    assert(shm_open(name, O_RDONLY, 0) < 0);
+    for (int i = 1; i < 10; ++i) {
+        free(ptrs[i]);
+    }
+}
+
+//! pid ok 1
+//! active 9 900 total 10 1000
+//! site test049.c:14 1000
@@ -0,0 +1,38 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Fragmentation report: live payload, size histogram and free extents.
+
+int main() {
+    m61_set_quarantine(0, 0);
+    char* ptrs[30];
+    for (int i = 0; i < 30; ++i) {
+        ptrs[i] = (char*) malloc(i < 20 ? 40 : 2000);
+    }
+    // free every other small block to leave holes
+    for (int i = 0; i < 20; i += 2) {
+        free(ptrs[i]);
+    }
+    m61_fragmentation_report();
+    for (int i = 0; i < 30; ++i) {
+        if (i >= 20 || i % 2) {
+            free(ptrs[i]);
+        }
+    }
+    m61_fragmentation_report();
+}
+
+//! FRAGMENTATION: 20 live blocks, 20400 payload bytes in ??? block bytes
+//! ???
+//!   live blocks by size:
+//!     ??? 10 blocks            400 payload ???
+//!     ??? 10 blocks          20000 payload ???
+//!   largest free extents:
+//! ???
+//! FRAGMENTATION: 0 live blocks, 0 payload bytes in 0 block bytes
+//!   overhead: 0 header + 0 canary + 0 slack = 0 bytes (0.0% of block bytes)
+//! ???
+//!   live blocks by size:
+//!   largest free extents:
+//! ???
@@ -0,0 +1,29 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Lifetime report: short-lived and long-lived call sites.
+
+int main() {
+    m61_set_lifetime_sample(1);
+    void* keep[10];
+    for (int i = 0; i < 10; ++i) {
+        keep[i] = malloc(1000);
+    }
+    for (int i = 0; i < 100; ++i) {
+        void* p = malloc(32);
+        free(p);
+    }
+    m61_print_lifetime_report();
+    for (int i = 0; i < 10; ++i) {
+        free(keep[i]);
+    }
+}
+
+//! LIFETIME REPORT: 110 sampled allocations, about 1 in 1
+//! short-lived sites (most bytes freed within 1 ms):
+//!   test051.c:14: 3200 of 3200 bytes short-lived (100%), 100 of 100 objects
+//!     lifetimes: ???
+//! long-lived sites (most bytes live 1 s or more, or still live):
+//!   test051.c:11: 10000 of 10000 bytes long-lived (100%), 10 of 10 objects, 10 still live
+//!     lifetimes:
@@ -0,0 +1,24 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Leak report grouped by call site, largest first.
+
+int main() {
+    m61_set_leak_report(M61_LEAK_SITES);
+    for (int i = 0; i < 100; ++i) {
+        (void) malloc(10);
+    }
+    for (int i = 0; i < 3; ++i) {
+        (void) malloc(1000);
+    }
+    void* p = malloc(5);
+    (void) malloc(7);
+    free(p);
+    m61_printleakreport();
+}
+
+//! LEAK CHECK: test???.c:13: 3 allocated objects with total size 3000, e.g. ???
+//! LEAK CHECK: test???.c:10: 100 allocated objects with total size 1000, e.g. ???
+//! LEAK CHECK: test???.c:16: 1 allocated objects with total size 7, e.g. ???
+//! LEAK CHECK: 104 objects with total size 4007 leaked from 3 sites
@@ -0,0 +1,40 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Backtraces split leaks from one allocation wrapper by caller.
+
+__attribute__((noinline)) static void* xalloc(size_t sz) {
+    void* p = malloc(sz);
+    // keep the call from becoming a tail call
+    __asm__ volatile("" ::: "memory");
+    return p;
+}
+
+__attribute__((noinline)) static void leak_three(void) {
+    for (volatile int i = 0; i < 3; ++i) {
+        (void) xalloc(100);
+    }
+    __asm__ volatile("" ::: "memory");
+}
+
+__attribute__((noinline)) static void leak_two(void) {
+    for (volatile int i = 0; i < 2; ++i) {
+        (void) xalloc(100);
+    }
+    __asm__ volatile("" ::: "memory");
+}
+
+int main() {
+    m61_set_stack_sample(1);
+    m61_set_leak_report(M61_LEAK_STACKS);
+    leak_three();
+    leak_two();
+    m61_printleakreport();
+}
+
+//! LEAK CHECK: test???.c:8: 3 allocated objects with total size 300, e.g. ???
+//! ???
+//! LEAK CHECK: test???.c:8: 2 allocated objects with total size 200, e.g. ???
+//! ???
+//! LEAK CHECK: 5 objects with total size 500 leaked from 2 stacks
@@ -0,0 +1,46 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+// Guard pages: writing one byte past a guarded block faults immediately.
+
+static char* volatile end;
+
+static void segv(int sig, siginfo_t* info, void* ctx) {
+    (void) sig, (void) ctx;
+    const char* msg = (char*) info->si_addr == end
+        ? "fault at end of block\n" : "fault somewhere else\n";
+    write(STDOUT_FILENO, msg, strlen(msg));
+    _exit(0);
+}
+
+int main() {
+    m61_set_guard(4096);
+    char* small = (char*) malloc(100);          // too small to guard
+    char* p = (char*) malloc(10000);
+    assert(((uintptr_t) p & 15) == 0);
+    memset(p, 'x', 10000);
+    // a freed mapping is reused for the next block of its size class
+    free(p);
+    p = (char*) malloc(9008);
+    memset(p, 'y', 9008);
+    free(small);
+    m61_printstatistics();
+    fflush(stdout);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = segv;
+    sa.sa_flags = SA_SIGINFO;
+    sigaction(SIGSEGV, &sa, NULL);
+    end = p + 9008;
+    volatile char* v = p;
+    v[9008] = 'z';
+    printf("no fault\n");
+}
+
+//! malloc count: active          1   total          3   fail          0
+//! malloc size:  active       9008   total      19108   fail          0
+//! fault at end of block
@@ -0,0 +1,20 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Guard pages: a block whose size is not a multiple of 16 ends a few bytes
+// before its guard page; writes there are caught at free.
+
+int main() {
+    m61_set_guard(4096);
+    char* p = (char*) malloc(5001);
+    assert(((uintptr_t) p & 15) == 0);
+    for (int i = 0; i <= 5004 /* Whoops! */; ++i) {
+        p[i] = i;
+    }
+    free(p);
+    m61_printstatistics();
+}
+
+//! MEMORY BUG???: detected wild write during free of pointer ???
+//! ???
@@ -0,0 +1,41 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+// Guard pages: a freed guarded block is inaccessible, so a use after free
+// faults.
+
+static char* volatile freed;
+
+static void segv(int sig, siginfo_t* info, void* ctx) {
+    (void) sig, (void) ctx;
+    const char* msg = (char*) info->si_addr == freed
+        ? "fault in freed block\n" : "fault somewhere else\n";
+    write(STDOUT_FILENO, msg, strlen(msg));
+    _exit(0);
+}
+
+int main() {
+    m61_set_guard(4096);
+    char* p = (char*) malloc(20000);
+    memset(p, 'x', 20000);
+    free(p);
+    m61_printstatistics();
+    fflush(stdout);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = segv;
+    sa.sa_flags = SA_SIGINFO;
+    sigaction(SIGSEGV, &sa, NULL);
+    freed = p + 100;
+    volatile char* v = p;
+    v[100] = 'y';
+    printf("no fault\n");
+}
+
+//! malloc count: active          0   total          1   fail          0
+//! malloc size:  active          0   total      20000   fail          0
+//! fault in freed block
@@ -0,0 +1,32 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Aligned allocation: payloads are aligned to every power of 2 from 16
+// bytes to 4 KiB, and free as usual.
+
+int main() {
+    void* ptrs[18];
+    int n = 0;
+    for (size_t align = 16; align <= 4096; align *= 2) {
+        char* p = (char*) memalign(align, 100);
+        assert(p && ((uintptr_t) p & (align - 1)) == 0);
+        memset(p, 'a', 100);
+        ptrs[n++] = p;
+        p = (char*) aligned_alloc(align, 3 * align);
+        assert(p && ((uintptr_t) p & (align - 1)) == 0);
+        memset(p, 'b', 3 * align);
+        ptrs[n++] = p;
+    }
+    // not a power of 2
+    assert(memalign(24, 100) == NULL);
+    // an aligned block can grow like any other
+    ptrs[0] = realloc(ptrs[0], 1000);
+    for (int i = 0; i < n; ++i) {
+        free(ptrs[i]);
+    }
+    m61_printstatistics();
+}
+
+//! malloc count: active          0   total         19   fail          1
+//! malloc size:  active          0   total      26428   fail        100
@@ -0,0 +1,18 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Aligned allocation: boundary write errors are still detected.
+
+int main() {
+    char* p = (char*) memalign(256, 100);
+    assert(((uintptr_t) p & 255) == 0);
+    for (int i = 0; i <= 100 /* Whoops! Should be < */; ++i) {
+        p[i] = i;
+    }
+    free(p);
+    m61_printstatistics();
+}
+
+//! MEMORY BUG???: detected wild write during free of pointer ???
+//! ???
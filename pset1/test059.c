@@ -0,0 +1,19 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Aligned allocation: invalid and double frees are still detected.
+
+int main() {
+    char* p = (char*) memalign(4096, 2001);
+    free(p);
+    free(p);
+    char* q = (char*) aligned_alloc(64, 2001);
+    free(q + 128);
+    m61_printstatistics();
+}
+
+//! MEMORY BUG: test???.c:10: invalid free of pointer ???, double free
+//! MEMORY BUG: test???.c:12: invalid free of pointer ???, not allocated
+//!   test???.c:11: ??? is 128 bytes inside a 2001 byte region allocated here
+//! ???
@@ -0,0 +1,36 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+// Large blocks get their own mappings, which are unmapped when freed.
+
+static int is_mapped(void* ptr) {
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    unsigned char vec;
+    void* page = (void*) ((uintptr_t) ptr & ~(pagesize - 1));
+    return mincore(page, 1, &vec) == 0;
+}
+
+int main() {
+    char* big = (char*) malloc(1 << 20);
+    memset(big, 'x', 1 << 20);
+    char* small = (char*) malloc(1000);
+    // grows in place within its mapping, or moves to a new one
+    big = (char*) realloc(big, (1 << 20) + 100);
+    assert(big[1000] == 'x');
+    printf("mapped: %d\n", is_mapped(big + 500000));
+    m61_printstatistics();
+    free(big);
+    printf("mapped after free: %d\n", is_mapped(big + 500000));
+    free(small);
+    m61_printstatistics();
+}
+
+//! mapped: 1
+//! malloc count: active          2   total          3   fail          0
+//! malloc size:  active    1049676   total    2098252   fail          0
+//! mapped after free: 0
+//! malloc count: active          0   total          3   fail          0
+//! malloc size:  active          0   total    2098252   fail          0
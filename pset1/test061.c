@@ -0,0 +1,63 @@
+#define M61_DISABLE 1
+#include "m61.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <malloc.h>
+#include <unistd.h>
+// libm61.so: a program that does not use m61.h runs on m61 under
+// LD_PRELOAD, with call sites named by return address. This test runs
+// itself again that way.
+
+int main(int argc, char** argv) {
+    if (argc == 1) {
+        char* args[] = {argv[0], "preloaded", NULL};
+        setenv("LD_PRELOAD", "./libm61.so", 1);
+        execv(argv[0], args);
+        perror("execv");
+        exit(1);
+    }
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    // m61 keeps the exact size; glibc would round it up
+    char* volatile p = (char*) malloc(10);
+    printf("usable %zu\n", malloc_usable_size(p));
+    strcpy(p, "abc");
+    p = (char*) realloc(p, 100000);
+    printf("realloc %s usable %zu\n", p, malloc_usable_size(p));
+
+    void* q;
+    int r = posix_memalign(&q, 4096, 100);
+    printf("posix_memalign %d aligned %d\n", r, (int) ((uintptr_t) q % 4096 == 0));
+    r = posix_memalign(&q, 24, 100);
+    printf("posix_memalign %d\n", r);
+    // not a power of 2, or not a multiple of sizeof(void*)
+    size_t bad[] = {0, 3, 12};
+    for (int i = 0; i < 3; ++i) {
+        r = posix_memalign(&q, bad[i], 100);
+        printf("posix_memalign %zu: %d\n", bad[i], r == EINVAL);
+    }
+
+    // rounding up to a page would wrap around
+    size_t volatile huge = (size_t) -100;
+    errno = 0;
+    q = pvalloc(huge);
+    printf("pvalloc %d %d\n", q == NULL, errno == ENOMEM);
+
+    char* z = (char*) calloc(8, 8);
+    printf("calloc %d\n", z[0] + z[63]);
+    free(z);
+    free(p);
+    free(p);
+}
+
+//! usable 10
+//! realloc abc usable 100000
+//! posix_memalign 0 aligned 1
+//! posix_memalign 22
+//! posix_memalign 0: 1
+//! posix_memalign 3: 1
+//! posix_memalign 12: 1
+//! pvalloc 1 1
+//! calloc 0
+//! MEMORY BUG: test061+0x???:0: invalid free of pointer ???, double free
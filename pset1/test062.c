@@ -0,0 +1,52 @@
+#include "m61.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+// Exiting while other threads are still allocating (and tracing) is safe.
+// Each run happens in a child process, so a crash at exit shows up in its
+// status.
+
+#define NRUNS 10
+#define NTHREADS 4
+
+static void* thread_main(void* arg) {
+    (void) arg;
+    for (unsigned i = 0; ; i = (i + 1) % 100) {
+        char* p = (char*) malloc(16 + i * 40);
+        memset(p, 'x', 16 + i * 40);
+        free(p);
+    }
+    return NULL;
+}
+
+int main() {
+    int clean = 0;
+    for (int run = 0; run < NRUNS; ++run) {
+        fflush(stdout);
+        pid_t p = fork();
+        if (p == 0) {
+            // with a trace on, its flush at exit races the threads too
+            m61_trace_start("/dev/null");
+            pthread_t t;
+            for (int i = 0; i < NTHREADS; ++i) {
+                pthread_create(&t, NULL, thread_main, NULL);
+            }
+            usleep(50000);
+            exit(0);
+        }
+        int status;
+        waitpid(p, &status, 0);
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            ++clean;
+        } else if (WIFSIGNALED(status)) {
+            printf("run %d: signal %d\n", run, WTERMSIG(status));
+        } else {
+            printf("run %d: exit status %d\n", run, WEXITSTATUS(status));
+        }
+    }
+    printf("clean exits: %d of %d\n", clean, NRUNS);
+}
+
+//! clean exits: 10 of 10
@@ -0,0 +1,68 @@
+#define M61_DISABLE 1
+#include "m61.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+// libm61.so: a threaded program can fork while other threads allocate,
+// and the child can allocate too. This test runs itself again with
+// LD_PRELOAD=./libm61.so; alarms turn a deadlock into a failure.
+
+#define NTHREADS 4
+#define NFORKS 200
+
+static volatile int stop = 0;
+
+static void* thread_main(void* arg) {
+    (void) arg;
+    for (unsigned i = 0; !stop; i = (i + 1) % 100) {
+        char* p = (char*) malloc(16 + i * 40);
+        memset(p, 'x', 16 + i * 40);
+        char* q = (char*) realloc(p, 32 + i * 80);
+        free(q);
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    if (argc == 1) {
+        char* args[] = {argv[0], "preloaded", NULL};
+        setenv("LD_PRELOAD", "./libm61.so", 1);
+        execv(argv[0], args);
+        perror("execv");
+        exit(1);
+    }
+    alarm(60);
+
+    pthread_t threads[NTHREADS];
+    for (int i = 0; i < NTHREADS; ++i) {
+        pthread_create(&threads[i], NULL, thread_main, NULL);
+    }
+    int clean = 0;
+    for (int f = 0; f < NFORKS; ++f) {
+        fflush(stdout);
+        pid_t p = fork();
+        if (p == 0) {
+            alarm(10);
+            for (int i = 0; i < 1000; ++i) {
+                free(malloc(16 + i * 8));
+            }
+            exit(0);
+        }
+        int status;
+        waitpid(p, &status, 0);
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            ++clean;
+        } else if (WIFSIGNALED(status)) {
+            printf("fork %d: signal %d\n", f, WTERMSIG(status));
+        }
+    }
+    stop = 1;
+    for (int i = 0; i < NTHREADS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    printf("clean children: %d of %d\n", clean, NFORKS);
+}
+
+//! clean children: 200 of 200
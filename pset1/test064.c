@@ -0,0 +1,58 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+// Batch allocations map large blocks on their own and reuse cached
+// small blocks, like single allocations.
+
+#define NBIG 8
+#define BIGSIZE (512 << 10)
+
+static int is_mapped(void* ptr) {
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    unsigned char vec;
+    void* page = (void*) ((uintptr_t) ptr & ~(pagesize - 1));
+    return mincore(page, 1, &vec) == 0;
+}
+
+int main() {
+    void* big[NBIG];
+    assert(malloc_batch(big, NBIG, BIGSIZE) == NBIG);
+    int mapped = 0;
+    for (int i = 0; i < NBIG; ++i) {
+        memset(big[i], 'x', BIGSIZE);
+        mapped += is_mapped((char*) big[i] + BIGSIZE / 2);
+    }
+    printf("mapped: %d\n", mapped);
+    m61_printstatistics();
+    free_batch(big, NBIG);
+    mapped = 0;
+    for (int i = 0; i < NBIG; ++i) {
+        mapped += is_mapped((char*) big[i] + BIGSIZE / 2);
+    }
+    printf("mapped after free: %d\n", mapped);
+
+    // a freed small block comes back from the thread cache
+    m61_set_quarantine(0, 0);
+    void* p = malloc(40);
+    free(p);
+    void* small[4];
+    assert(malloc_batch(small, 4, 40) == 4);
+    int reused = 0;
+    for (int i = 0; i < 4; ++i) {
+        reused += small[i] == p;
+    }
+    printf("reused: %d\n", reused);
+    free_batch(small, 4);
+    m61_printstatistics();
+}
+
+//! mapped: 8
+//! malloc count: active          8   total          8   fail          0
+//! malloc size:  active    4194304   total    4194304   fail          0
+//! mapped after free: 0
+//! reused: 1
+//! malloc count: active          0   total         13   fail          0
+//! malloc size:  active          0   total    4194504   fail          0
@@ -0,0 +1,67 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+// The fragmentation report's free extents are memory m61 holds free, never
+// the address space between heap blocks and a block mapped on its own.
+
+#define BIGSIZE (1 << 20)
+
+int main() {
+    char* small[20];
+    for (int i = 0; i < 20; ++i) {
+        small[i] = (char*) malloc(100);
+    }
+    char* big = (char*) malloc(BIGSIZE);
+    char* more[20];
+    for (int i = 0; i < 20; ++i) {
+        more[i] = (char*) malloc(100);
+    }
+    for (int i = 0; i < 20; i += 2) {
+        free(small[i]);
+        free(more[i]);
+    }
+
+    // capture the report
+    FILE* f = tmpfile();
+    assert(f);
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    dup2(fileno(f), STDOUT_FILENO);
+    m61_fragmentation_report();
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+
+    rewind(f);
+    char line[256];
+    int in_extents = 0, nextents = 0, crossing = 0;
+    while (fgets(line, sizeof(line), f)) {
+        void* start;
+        size_t size;
+        if (strstr(line, "largest")) {
+            in_extents = 1;
+        } else if (in_extents && sscanf(line, " %p: %zu bytes", &start, &size) == 2) {
+            ++nextents;
+            // the mapping holding `big`, with a page of room for its header
+            char* lo = big - sysconf(_SC_PAGESIZE);
+            char* hi = big + BIGSIZE;
+            if ((char*) start < hi && (char*) start + size > lo) {
+                ++crossing;
+            }
+        }
+    }
+    fclose(f);
+    printf("free extents found: %d\n", nextents > 0);
+    printf("extents touching the mapped block: %d\n", crossing);
+
+    for (int i = 1; i < 20; i += 2) {
+        free(small[i]);
+        free(more[i]);
+    }
+    free(big);
+}
+
+//! free extents found: 1
+//! extents touching the mapped block: 0